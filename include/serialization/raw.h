@@ -8,6 +8,7 @@ raw serialization to char buffer[]
 
 #pragma once
 
+#include <cstddef> // size_t
 #include <cstring> // memcpy
 #include <utility> // std::move
 
@@ -56,6 +57,60 @@ struct RawDeserializer:
 {
 };
 
+/*
+ * skipper template class: advance buffer past an encoded TO without decoding it
+ * read-side counterpart of RawDrySerializer, no object involved
+ *
+ */
+template <typename TB, typename TO, typename Test = void>
+struct RawSkipper
+{
+    inline TB operator()(TB buffer) const
+    {
+        static_assert(is_zero_size_object<TO>::value,
+                "no suitable skip for TO found; " \
+                "make TO whiltelisted in is_serialization_copyable<TO> " \
+                "to invoke default skip, " \
+                "or implement it.");
+
+        return buffer;
+    }
+};
+
+/*
+ * validator template class: check an encoded TO against the buffer end
+ * without materializing it
+ *
+ *      bool operator()(TB& buffer, TB end, size_t& demand)
+ *          advance buffer past TO, false if TO does not fit in [buffer, end)
+ *          or is malformed, the heap footprint of TO is added to demand
+ *
+ */
+template <typename TB, typename TO, typename Test = void>
+struct RawValidator
+{
+    inline bool operator()(TB& /*buffer*/, TB /*end*/, size_t& /*demand*/) const
+    {
+        static_assert(is_zero_size_object<TO>::value,
+                "no suitable validation for TO found; " \
+                "make TO whiltelisted in is_serialization_copyable<TO> " \
+                "to invoke default validation, " \
+                "or implement it.");
+
+        return true;
+    }
+};
+
+/*
+ * @@@ extensiable trait indicating TB is a stream buffer doing its own bookkeeping
+ *
+ * implementations relying on pointer arithmetic over TB are disabled for it,
+ * stream buffers provide their own (see raw_stream.h)
+ *
+ */
+template <typename TB, typename Test = void>
+struct is_stream_buffer: std::false_type {};
+
 template <template <typename...> class  F, typename TB = char, typename TO = char>
 using is_either_serializer = conditional_or_t<
     std::is_same<F<TB, TO>, RawSerializer<TB, TO>>::value,
@@ -136,6 +191,44 @@ inline auto deserialize(TB buffer, TO& object)
     return RawSerializationMultiplexer<RawDeserializer, TB, TO>()(buffer, object);
 }
 
+template <typename TO, typename TB>
+inline TB skip(TB buffer)
+{
+    static_assert(is_serializable<TO>::value,
+            "TO is not serializable, if there is any implementation, " \
+            "please make TO whiltelisted in is_serializable<TO>.");
+
+    return RawSkipper<TB, TO>()(buffer);
+}
+
+/*
+ * validate an encoded TO in [buffer, end) for untrusted input: the end of TO,
+ * or nullptr if it is truncated or malformed
+ * demand is set to the heap footprint deserialize would allocate
+ *
+ * deserialize is unchecked, run it on validated input only
+ *
+ */
+template <typename TO, typename TB>
+inline TB validate(TB buffer, TB end, size_t& demand)
+{
+    static_assert(is_serializable<TO>::value,
+            "TO is not serializable, if there is any implementation, " \
+            "please make TO whiltelisted in is_serializable<TO>.");
+
+    demand = 0;
+
+    return RawValidator<TB, TO>()(buffer, end, demand) ? buffer : nullptr;
+}
+
+template <typename TO, typename TB>
+inline TB validate(TB buffer, TB end)
+{
+    size_t demand;
+
+    return validate<TO>(buffer, end, demand);
+}
+
 template <typename T>
 inline auto serialized_size(const T& object)
     -> decltype(std::declval<const char*>() - std::declval<const char*>())
@@ -159,8 +252,37 @@ struct RawDrySerializer<TB, TO,
 };
 
 template <typename TB, typename TO>
-struct RawSerializer<TB, TO,
+struct RawSkipper<TB, TO,
         enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    inline TB operator()(TB buffer) const
+    {
+        return buffer + relative_size_of<TO, decltype(*buffer)>::value;
+    }
+};
+
+template <typename TB, typename TO>
+struct RawValidator<TB, TO,
+        enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& /*demand*/) const
+    {
+        if (size_t(end - buffer) < relative_size_of<TO, decltype(*buffer)>::value)
+        {
+            return false;
+        }
+
+        buffer += relative_size_of<TO, decltype(*buffer)>::value;
+        return true;
+    }
+};
+
+template <typename TB, typename TO>
+struct RawSerializer<TB, TO,
+        enable_if_t<
+            is_serialization_copyable<TO>::value &&
+            !is_stream_buffer<TB>::value
+        >>
 {
     inline TB operator()(TB buffer, TO& object) const
     {
@@ -171,7 +293,10 @@ struct RawSerializer<TB, TO,
 
 template <typename TB, typename TO>
 struct RawDeserializer<TB, TO,
-        enable_if_t<is_serialization_copyable<TO>::value>>
+        enable_if_t<
+            is_serialization_copyable<TO>::value &&
+            !is_stream_buffer<TB>::value
+        >>
 {
     inline TB operator()(TB buffer, TO& object) const
     {
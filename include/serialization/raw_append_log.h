@@ -0,0 +1,203 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+multi-producer append log with atomic space reservation
+
+*/
+
+#pragma once
+
+#include <atomic>  // for std::atomic
+#include <cstddef> // for size_t
+#include <memory>  // for std::unique_ptr
+
+#include "raw.h"
+#include "raw_ring.h" // for raw_cache_line_size
+
+namespace NAMESPACE
+{
+
+/*
+ * bounded append log of serialized records, many producers, one reader
+ *
+ * record layout, in size_t words:
+ *
+ *      | header | payload[size] | padding |
+ *
+ * header:
+ *      0                   reserved, not committed yet
+ *      size << 1 | 1       committed
+ *      end_mark            the log is full from here on
+ *
+ * producers reserve a record with a single fetch_add on the tail, serialize
+ * into the reservation and commit it by storing its header, the reader walks
+ * the records in reservation order and stops at the first uncommitted one
+ *
+ * a producer whose reservation overruns the capacity writes end_mark instead,
+ * the log must then be drained and reset() with the producers quiescent
+ *
+ */
+class RawAppendLog
+{
+public:
+    explicit RawAppendLog(size_t capacity):
+        capacity_((capacity + sizeof(size_t) - 1) / sizeof(size_t)),
+        storage_(new std::atomic<size_t>[capacity_]),
+        tail_(0),
+        head_(0), head_pending_(0)
+    {
+        clear(capacity_);
+    }
+
+    RawAppendLog(const RawAppendLog&) = delete;
+    RawAppendLog& operator=(const RawAppendLog&) = delete;
+
+    inline size_t capacity() const
+    {
+        return capacity_ * sizeof(size_t);
+    }
+
+    /*
+     * producer: reserve size bytes, nullptr if the log is full
+     * thread-safe, the record must be commit()-ed afterwards
+     *
+     */
+    inline char* reserve(size_t size)
+    {
+        const size_t words = 1 + (size + sizeof(size_t) - 1) / sizeof(size_t);
+        const size_t offset = tail_.fetch_add(words, std::memory_order_relaxed);
+
+        if (offset + words > capacity_ || offset + words < offset)
+        {
+            if (offset < capacity_)
+            {
+                storage_[offset].store(end_mark, std::memory_order_release);
+            }
+
+            return nullptr;
+        }
+
+        return reinterpret_cast<char*>(&storage_[offset + 1]);
+    }
+
+    // producer: publish a record of size bytes returned by reserve(size)
+    inline void commit(char* buffer, size_t size)
+    {
+        header(buffer).store(size << 1 | 1, std::memory_order_release);
+    }
+
+    // producer: serialize object as a record, false if the log is full
+    template <typename TO>
+    inline bool append(const TO& object)
+    {
+        const size_t size = serialized_size(object);
+        const auto buffer = reserve(size);
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        serialize(buffer, object);
+        commit(buffer, size);
+        return true;
+    }
+
+    /*
+     * reader: the next committed record and its size, nullptr if it is not
+     * committed yet or the log is exhausted
+     *
+     */
+    inline const char* peek(size_t& size)
+    {
+        if (head_ >= capacity_)
+        {
+            return nullptr;
+        }
+
+        const size_t value = storage_[head_].load(std::memory_order_acquire);
+
+        if (value == 0 || value == end_mark)
+        {
+            return nullptr;
+        }
+
+        size = value >> 1;
+        head_pending_ = head_ + 1 + (size + sizeof(size_t) - 1) / sizeof(size_t);
+        return reinterpret_cast<const char*>(&storage_[head_ + 1]);
+    }
+
+    // reader: step over the last peeked record
+    inline void release()
+    {
+        head_ = head_pending_;
+    }
+
+    // reader: deserialize the next committed record, false if there is none
+    template <typename TO>
+    inline bool consume(TO& object)
+    {
+        size_t size;
+        const auto buffer = peek(size);
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        deserialize(buffer, object);
+        release();
+        return true;
+    }
+
+    // reader: every record has been consumed and no more fit in
+    inline bool exhausted() const
+    {
+        return head_ >= capacity_ ||
+                storage_[head_].load(std::memory_order_acquire) == end_mark;
+    }
+
+    // start over, neither producers nor the reader may be active
+    inline void reset()
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+
+        clear(tail < capacity_ ? tail : capacity_);
+        tail_.store(0, std::memory_order_relaxed);
+        head_ = head_pending_ = 0;
+    }
+
+private:
+    static const size_t end_mark = ~size_t(0);
+
+    inline std::atomic<size_t>& header(char* buffer)
+    {
+        return *(reinterpret_cast<std::atomic<size_t>*>(buffer) - 1);
+    }
+
+    inline void clear(size_t words)
+    {
+        for (size_t idx = 0; idx < words; ++idx)
+        {
+            storage_[idx].store(0, std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // shared, read-only
+    const size_t capacity_; // in words
+    const std::unique_ptr<std::atomic<size_t>[]> storage_;
+
+    // producers
+    alignas(raw_cache_line_size) std::atomic<size_t> tail_;
+
+    // reader
+    alignas(raw_cache_line_size) size_t head_;
+    size_t head_pending_;
+
+    char padding_[raw_cache_line_size - 2 * sizeof(size_t)];
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,216 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+canonical serialization: the unordered containers written in the order of
+their serialized items, so equal objects serialize to equal bytes
+
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <cstring> // for memcmp, memcpy
+#include <thread>  // for std::thread::hardware_concurrency
+#include <vector>
+
+#include "raw_hash.h"     // for RawHashWriter, RawXxHash64
+#include "raw_parallel.h" // for parallel_sort
+#include "raw_pool.h"     // for RawBoundedWriter
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * vector writer: stream policy appending to a std::vector<char>
+ *
+ */
+class RawVectorWriter
+{
+public:
+    explicit RawVectorWriter(std::vector<char>& bytes):
+        bytes_(bytes)
+    {
+    }
+
+    RawVectorWriter(const RawVectorWriter&) = delete;
+    RawVectorWriter& operator=(const RawVectorWriter&) = delete;
+
+    inline void write(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+
+        bytes_.insert(bytes_.end(), bytes, bytes + size);
+    }
+
+private:
+    std::vector<char>& bytes_;
+};
+
+/*
+ * canonical writer: stream policy passing the bytes to the writer TS, with
+ * the items of the unordered containers sorted by their serialized bytes,
+ * the nested unordered containers sorted first
+ *
+ * the output is the same format as serialize(), deserialized as usual
+ *
+ * tables of parallel_size items or more are sorted by thread_count threads
+ *
+ */
+template <class TS>
+class RawCanonicalWriter
+{
+public:
+    static const size_t parallel_size = 1 << 14;
+
+    explicit RawCanonicalWriter(TS& sink,
+            size_t thread_count = std::thread::hardware_concurrency()):
+        sink_(sink), thread_count_(thread_count > 0 ? thread_count : 1)
+    {
+    }
+
+    RawCanonicalWriter(const RawCanonicalWriter&) = delete;
+    RawCanonicalWriter& operator=(const RawCanonicalWriter&) = delete;
+
+    inline void write(const void* data, size_t size)
+    {
+        sink_.write(data, size);
+    }
+
+    inline size_t thread_count() const
+    {
+        return thread_count_;
+    }
+
+private:
+    TS& sink_;
+    const size_t thread_count_;
+};
+
+template <class TS>
+struct is_canonical_stream<RawCanonicalWriter<TS>>: std::true_type {};
+
+/*
+ * for:
+ *      std::unordered_map<TK, TV, ...>, std::unordered_set<TI, ...> ...
+ *
+ * the items are serialized apart, then written in the lexicographic order
+ * of their bytes; as the encoding is self-delimiting, the items of maps
+ * are so ordered by key bytes first
+ *
+ */
+template <class TS, class T>
+struct RawSerializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            is_canonical_stream<TS>::value &&
+            is_unordered_container_type<T>::value
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = value_type_t<T>;
+    using TV = RawStreamBuffer<RawCanonicalWriter<RawVectorWriter>>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size = container.size();
+
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, size_t>()(buffer, size);
+        if (size == 0)
+        {
+            return buffer;
+        }
+
+        const size_t thread_count = buffer.stream->thread_count();
+        std::vector<char> bytes;
+        std::vector<size_t> offsets;
+
+        bytes.reserve(size * sizeof(TI));
+        offsets.reserve(size + 1);
+
+        {
+            RawVectorWriter writer(bytes);
+            RawCanonicalWriter<RawVectorWriter> canonical(writer, thread_count);
+            const TV item_buffer = make_stream_buffer(canonical);
+
+            for (const auto& item: container)
+            {
+                offsets.push_back(bytes.size());
+                RawSerializationMultiplexer<RawSerializer, TV, const TI>()(item_buffer, item);
+            }
+            offsets.push_back(bytes.size());
+        }
+
+        std::vector<size_t> order(size);
+
+        for (size_t idx = 0; idx < size; ++idx)
+        {
+            order[idx] = idx;
+        }
+
+        const char* const data = bytes.data();
+        auto less = [&](size_t lhs, size_t rhs)
+        {
+            const size_t lhs_size = offsets[lhs + 1] - offsets[lhs];
+            const size_t rhs_size = offsets[rhs + 1] - offsets[rhs];
+            const int result = memcmp(data + offsets[lhs], data + offsets[rhs],
+                    lhs_size < rhs_size ? lhs_size : rhs_size);
+
+            return result < 0 || (result == 0 && lhs_size < rhs_size);
+        };
+
+        parallel_sort(order.begin(), order.end(), less,
+                size < RawCanonicalWriter<TS>::parallel_size ? 1 : thread_count);
+
+        // written in one piece
+        std::vector<char> sorted(bytes.size());
+        char* head = sorted.data();
+
+        for (auto idx: order)
+        {
+            memcpy(head, data + offsets[idx], offsets[idx + 1] - offsets[idx]);
+            head += offsets[idx + 1] - offsets[idx];
+        }
+
+        buffer.stream->write(sorted.data(), sorted.size());
+        return buffer;
+    }
+};
+
+/*
+ * canonical serialization of object, the same size as serialize() gives
+ *
+ */
+template <typename TO>
+inline std::vector<char> serialize_canonical(const TO& object,
+        size_t thread_count = std::thread::hardware_concurrency())
+{
+    std::vector<char> buf(serialized_size(object));
+    RawBoundedWriter writer(buf.data(), buf.size());
+    RawCanonicalWriter<RawBoundedWriter> canonical(writer, thread_count);
+
+    serialize(make_stream_buffer(canonical), object);
+    return buf;
+}
+
+/*
+ * structural_hash() of the canonical serialization, equal for equal
+ * unordered containers
+ *
+ */
+template <typename TO>
+inline uint64_t canonical_hash(const TO& object, uint64_t seed = 0,
+        size_t thread_count = std::thread::hardware_concurrency())
+{
+    RawXxHash64 checksum(seed);
+    RawHashWriter<RawXxHash64> writer(checksum);
+    RawCanonicalWriter<RawHashWriter<RawXxHash64>> canonical(writer, thread_count);
+
+    serialize(make_stream_buffer(canonical), object);
+    writer.flush();
+    return checksum.value();
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,473 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+incremental checkpoints: containers tracking their dirty chunks, and a store
+writing only the changed chunks on top of a base
+
+*/
+
+#pragma once
+
+#include <algorithm>     // for std::copy
+#include <cerrno>        // for errno
+#include <cstddef>       // for size_t
+#include <functional>    // for std::hash
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>       // for std::pair, std::move
+#include <vector>
+
+#include <unistd.h> // for unlink
+
+#include "raw_file.h"
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * std::vector<T> tracking its dirty chunks of chunk_size items
+ *
+ * any non-const access marks the chunk of the item dirty, delta() holds
+ * the size and the dirty chunks, apply() composes it on top
+ *
+ */
+template <typename T>
+class RawTrackedVector
+{
+public:
+    // chunk size, size, chunks of (index, items)
+    using delta_type = std::tuple<size_t, size_t, std::vector<std::pair<size_t, std::vector<T>>>>;
+
+    explicit RawTrackedVector(size_t chunk_size = 4096):
+        chunk_size_(chunk_size)
+    {
+    }
+
+    inline size_t size() const
+    {
+        return items_.size();
+    }
+
+    inline const T& operator[](size_t index) const
+    {
+        return items_[index];
+    }
+
+    inline T& operator[](size_t index)
+    {
+        touch(index, index + 1);
+        return items_[index];
+    }
+
+    inline void push_back(T item)
+    {
+        items_.push_back(std::move(item));
+        touch(items_.size() - 1, items_.size());
+    }
+
+    inline void resize(size_t size)
+    {
+        const size_t first = size < items_.size() ? size : items_.size();
+
+        items_.resize(size);
+        touch(first, size);
+    }
+
+    inline const std::vector<T>& items() const
+    {
+        return items_;
+    }
+
+    // the dirty chunks, or all of them
+    inline delta_type delta(bool all = false) const
+    {
+        delta_type result;
+
+        std::get<0>(result) = chunk_size_;
+        std::get<1>(result) = items_.size();
+        for (size_t chunk = 0; chunk * chunk_size_ < items_.size(); ++chunk)
+        {
+            if (all || (chunk < dirty_.size() && dirty_[chunk]))
+            {
+                const size_t first = chunk * chunk_size_;
+                const size_t last = first + chunk_size_ < items_.size() ?
+                        first + chunk_size_ : items_.size();
+
+                std::get<2>(result).emplace_back(chunk,
+                        std::vector<T>(items_.begin() + first, items_.begin() + last));
+            }
+        }
+
+        return result;
+    }
+
+    /*
+     * compose delta on top, false if its chunk size does not match or a
+     * chunk runs past its size, with nothing applied
+     *
+     */
+    inline bool apply(const delta_type& delta)
+    {
+        const size_t size = std::get<1>(delta);
+
+        if (std::get<0>(delta) != chunk_size_)
+        {
+            return false;
+        }
+        for (const auto& chunk: std::get<2>(delta))
+        {
+            if (chunk.first > size / chunk_size_ ||
+                    chunk.second.size() > size - chunk.first * chunk_size_)
+            {
+                return false;
+            }
+        }
+
+        items_.resize(size);
+        for (const auto& chunk: std::get<2>(delta))
+        {
+            std::copy(chunk.second.begin(), chunk.second.end(),
+                    items_.begin() + chunk.first * chunk_size_);
+        }
+
+        return true;
+    }
+
+    // forget the dirty chunks, after a checkpoint
+    inline void clean()
+    {
+        dirty_.assign(dirty_.size(), false);
+    }
+
+private:
+    inline void touch(size_t first, size_t last)
+    {
+        if (first >= last)
+        {
+            return;
+        }
+
+        const size_t chunk_last = (last - 1) / chunk_size_ + 1;
+
+        if (dirty_.size() < chunk_last)
+        {
+            dirty_.resize(chunk_last, false);
+        }
+        for (size_t chunk = first / chunk_size_; chunk < chunk_last; ++chunk)
+        {
+            dirty_[chunk] = true;
+        }
+    }
+
+    const size_t chunk_size_;
+    std::vector<T> items_;
+    std::vector<bool> dirty_;
+};
+
+/*
+ * std::unordered_map<TK, TV> split by key hash into partitions, tracking
+ * the dirty ones
+ *
+ * a dirty partition goes to delta() as a whole, so erased keys vanish on
+ * apply() as well
+ *
+ */
+template <typename TK, typename TV, typename TH = std::hash<TK>>
+class RawTrackedMap
+{
+public:
+    using partition_type = std::unordered_map<TK, TV, TH>;
+    // partition count, partitions of (index, entries)
+    using delta_type = std::tuple<size_t, std::vector<std::pair<size_t, partition_type>>>;
+
+    explicit RawTrackedMap(size_t partition_count = 1024):
+        partitions_(partition_count), dirty_(partition_count, false)
+    {
+    }
+
+    inline size_t size() const
+    {
+        size_t count = 0;
+
+        for (const auto& partition: partitions_)
+        {
+            count += partition.size();
+        }
+
+        return count;
+    }
+
+    // the value of key, nullptr if absent
+    inline const TV* find(const TK& key) const
+    {
+        const auto& partition = partitions_[index_of(key)];
+        const auto item = partition.find(key);
+
+        return item == partition.end() ? nullptr : &item->second;
+    }
+
+    inline TV& operator[](const TK& key)
+    {
+        const size_t index = index_of(key);
+
+        dirty_[index] = true;
+        return partitions_[index][key];
+    }
+
+    inline size_t erase(const TK& key)
+    {
+        const size_t index = index_of(key);
+        const size_t count = partitions_[index].erase(key);
+
+        dirty_[index] = dirty_[index] || count > 0;
+        return count;
+    }
+
+    inline const std::vector<partition_type>& partitions() const
+    {
+        return partitions_;
+    }
+
+    // the dirty partitions, or all of them
+    inline delta_type delta(bool all = false) const
+    {
+        delta_type result;
+
+        std::get<0>(result) = partitions_.size();
+        for (size_t index = 0; index < partitions_.size(); ++index)
+        {
+            if (all || dirty_[index])
+            {
+                std::get<1>(result).emplace_back(index, partitions_[index]);
+            }
+        }
+
+        return result;
+    }
+
+    // compose delta on top, false if its partition count does not match
+    inline bool apply(const delta_type& delta)
+    {
+        if (std::get<0>(delta) != partitions_.size())
+        {
+            return false;
+        }
+
+        for (const auto& partition: std::get<1>(delta))
+        {
+            if (partition.first < partitions_.size())
+            {
+                partitions_[partition.first] = partition.second;
+            }
+        }
+
+        return true;
+    }
+
+    // forget the dirty partitions, after a checkpoint
+    inline void clean()
+    {
+        dirty_.assign(dirty_.size(), false);
+    }
+
+private:
+    inline size_t index_of(const TK& key) const
+    {
+        return TH()(key) % partitions_.size();
+    }
+
+    std::vector<partition_type> partitions_;
+    std::vector<bool> dirty_;
+};
+
+/*
+ * checkpoint store of tracked containers under a path prefix:
+ *
+ *      <prefix>.<n>        base, all chunks
+ *      <prefix>.<n + 1>    delta, the dirty chunks since the previous one ...
+ *      <prefix>.manifest   the next n, the files to compose in order
+ *
+ * every file is written aside, synced and renamed into place, the manifest
+ * last, and file numbers are never reused, so a crash leaves the previous
+ * checkpoint intact
+ *
+ */
+class RawCheckpointStore
+{
+public:
+    explicit RawCheckpointStore(std::string prefix):
+        prefix_(std::move(prefix)), next_(0), current_(false)
+    {
+    }
+
+    /*
+     * write the dirty chunks of containers as a delta, all of them as a new
+     * base on the first call without restore() or if rebase, and mark them
+     * clean
+     * 0, or -1 with errno set
+     *
+     */
+    template <typename ...TC>
+    inline int checkpoint(bool rebase, TC&... containers)
+    {
+        // numbered after the files of a checkpoint left by a previous run
+        if (!current_)
+        {
+            Manifest manifest;
+
+            if (read_object(prefix_ + ".manifest", manifest) == 0)
+            {
+                next_ = manifest.first;
+                files_ = std::move(manifest.second);
+            }
+            else if (errno != ENOENT)
+            {
+                return -1;
+            }
+        }
+
+        rebase = rebase || !current_ || files_.empty();
+
+        const auto deltas = std::make_tuple(containers.delta(rebase)...);
+        const std::string path = prefix_ + "." + std::to_string(next_);
+
+        if (write_object(path, deltas) < 0)
+        {
+            return -1;
+        }
+
+        Manifest manifest(next_ + 1, rebase ? std::vector<std::string>() : files_);
+
+        manifest.second.push_back(path);
+        if (write_object(prefix_ + ".manifest", manifest) < 0)
+        {
+            return -1;
+        }
+
+        if (rebase)
+        {
+            for (const auto& file: files_)
+            {
+                unlink(file.c_str());
+            }
+        }
+
+        next_ = manifest.first;
+        files_ = std::move(manifest.second);
+        current_ = true;
+        clean(containers...);
+        return 0;
+    }
+
+    /*
+     * compose the base and the deltas into empty containers
+     * 0, or -1 with errno set, EBADMSG for a corrupt file or a container
+     * not shaped as checkpointed
+     *
+     */
+    template <typename ...TC>
+    inline int restore(TC&... containers)
+    {
+        Manifest manifest;
+
+        if (read_object(prefix_ + ".manifest", manifest) < 0)
+        {
+            return -1;
+        }
+
+        for (const auto& path: manifest.second)
+        {
+            std::tuple<typename TC::delta_type...> deltas;
+
+            if (read_object(path, deltas) < 0)
+            {
+                return -1;
+            }
+
+            if (!apply(deltas, containers...))
+            {
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+
+        next_ = manifest.first;
+        files_ = std::move(manifest.second);
+        current_ = true;
+        clean(containers...);
+        return 0;
+    }
+
+    // files of the last checkpoint, base first
+    inline const std::vector<std::string>& files() const
+    {
+        return files_;
+    }
+
+private:
+    using Manifest = std::pair<size_t, std::vector<std::string>>; // next n, files
+
+    static inline void clean()
+    {
+    }
+
+    template <typename TC, typename ...Args>
+    static inline void clean(TC& container, Args&... containers)
+    {
+        container.clean();
+        clean(containers...);
+    }
+
+    template <size_t I = 0, typename TT>
+    static inline bool apply(const TT&)
+    {
+        return true;
+    }
+
+    template <size_t I = 0, typename TT, typename TC, typename ...Args>
+    static inline bool apply(const TT& deltas, TC& container, Args&... containers)
+    {
+        return container.apply(std::get<I>(deltas)) && apply<I + 1>(deltas, containers...);
+    }
+
+    template <typename TO>
+    static inline int write_object(const std::string& path, const TO& object)
+    {
+        std::vector<char> buf(serialized_size(object));
+
+        serialize(buf.data(), object);
+        return write_file_atomic(path, buf.data(), buf.size());
+    }
+
+    template <typename TO>
+    static inline int read_object(const std::string& path, TO& object)
+    {
+        std::vector<char> buf;
+
+        if (read_file(path, buf) < 0)
+        {
+            return -1;
+        }
+
+        const char* const end = buf.data() + buf.size();
+
+        if (validate<TO>(static_cast<const char*>(buf.data()), end) != end)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        deserialize(static_cast<const char*>(buf.data()), object);
+        return 0;
+    }
+
+    const std::string prefix_;
+    size_t next_;
+    std::vector<std::string> files_;
+    bool current_; // files_ compose the containers
+};
+
+} // namespace NAMESPACE
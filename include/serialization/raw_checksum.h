@@ -0,0 +1,621 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+checksums of serialized bytes: CRC32C (Castagnoli), with the SSE4.2 or ARMv8
+CRC instructions when available, and xxHash64; stream policies computing
+them in the serialization pass
+
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint8_t, uint32_t, uint64_t
+#include <cstring> // for memcpy
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h> // for _mm_crc32_u64, _mm_crc32_u8
+#define RAW_CRC32C_HARDWARE 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>  // for __crc32cd, __crc32cb
+#define RAW_CRC32C_HARDWARE 1
+#endif
+
+#include "raw_limits.h" // for RawMemoryReader
+#include "raw_pool.h"   // for RawBoundedWriter
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * CRC32C tables for slicing by 8: table[k][b] is the CRC of byte b followed
+ * by k zero bytes
+ *
+ */
+struct RawCrc32cTable
+{
+    uint32_t words[8][256];
+
+    RawCrc32cTable()
+    {
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            uint32_t crc = byte;
+
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+            }
+
+            words[0][byte] = crc;
+        }
+
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            for (size_t slice = 1; slice < 8; ++slice)
+            {
+                const uint32_t crc = words[slice - 1][byte];
+
+                words[slice][byte] = (crc >> 8) ^ words[0][crc & 0xff];
+            }
+        }
+    }
+
+    static inline const RawCrc32cTable& instance()
+    {
+        static const RawCrc32cTable table;
+
+        return table;
+    }
+};
+
+// CRC32C without the CRC instructions, see crc32c()
+inline uint32_t crc32c_portable(const void* data, size_t size, uint32_t crc = 0)
+{
+    const auto& table = RawCrc32cTable::instance().words;
+    auto bytes = static_cast<const uint8_t*>(data);
+
+    crc = ~crc;
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+
+        memcpy(&low, bytes, sizeof(low));
+        memcpy(&high, bytes + 4, sizeof(high));
+        low ^= crc; // little endian
+
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+                table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+                table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+                table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+    }
+
+    for (; size > 0; ++bytes, --size)
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *bytes) & 0xff];
+    }
+
+    return ~crc;
+}
+
+#ifdef RAW_CRC32C_HARDWARE
+
+/*
+ * CRC32C register shift over stride zero bytes, linear in the register:
+ * table[k][b] is the shift of byte b at bit 8 * k
+ *
+ * the CRC instruction has a latency of 3 cycles and a throughput of 1, so
+ * three interleaved streams of stride bytes run 3 times as fast, their
+ * registers then combined by shifts
+ *
+ */
+struct RawCrc32cShiftTable
+{
+    static const size_t stride = 1024;
+
+    uint32_t words[4][256];
+
+    RawCrc32cShiftTable()
+    {
+        const auto& table = RawCrc32cTable::instance().words;
+        uint32_t basis[32];
+
+        for (size_t bit = 0; bit < 32; ++bit)
+        {
+            uint32_t crc = uint32_t(1) << bit;
+
+            for (size_t idx = 0; idx < stride; ++idx)
+            {
+                crc = (crc >> 8) ^ table[0][crc & 0xff];
+            }
+
+            basis[bit] = crc;
+        }
+
+        for (size_t slice = 0; slice < 4; ++slice)
+        {
+            for (uint32_t byte = 0; byte < 256; ++byte)
+            {
+                uint32_t crc = 0;
+
+                for (size_t bit = 0; bit < 8; ++bit)
+                {
+                    crc ^= (byte >> bit & 1) ? basis[8 * slice + bit] : 0;
+                }
+
+                words[slice][byte] = crc;
+            }
+        }
+    }
+
+    inline uint32_t shift(uint32_t crc) const
+    {
+        return words[0][crc & 0xff] ^ words[1][(crc >> 8) & 0xff] ^
+                words[2][(crc >> 16) & 0xff] ^ words[3][crc >> 24];
+    }
+
+    static inline const RawCrc32cShiftTable& instance()
+    {
+        static const RawCrc32cShiftTable table;
+
+        return table;
+    }
+};
+
+#if defined(__x86_64__)
+
+inline bool has_crc32c_hardware()
+{
+    static const bool result = __builtin_cpu_supports("sse4.2");
+
+    return result;
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_hardware_word(uint32_t crc, uint64_t word)
+{
+    return uint32_t(_mm_crc32_u64(crc, word));
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_hardware_byte(uint32_t crc, uint8_t byte)
+{
+    return _mm_crc32_u8(crc, byte);
+}
+
+#else
+
+inline bool has_crc32c_hardware()
+{
+    return true;
+}
+
+inline uint32_t crc32c_hardware_word(uint32_t crc, uint64_t word)
+{
+    return __crc32cd(crc, word);
+}
+
+inline uint32_t crc32c_hardware_byte(uint32_t crc, uint8_t byte)
+{
+    return __crc32cb(crc, byte);
+}
+
+#endif
+
+// CRC32C with the CRC instructions, see crc32c()
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+#endif
+inline uint32_t crc32c_hardware(const void* data, size_t size, uint32_t crc = 0)
+{
+    const size_t stride = RawCrc32cShiftTable::stride;
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint64_t words[3];
+
+    crc = ~crc;
+    if (size >= 3 * stride)
+    {
+        const auto& table = RawCrc32cShiftTable::instance();
+
+        for (; size >= 3 * stride; bytes += 3 * stride, size -= 3 * stride)
+        {
+            uint32_t crc0 = crc;
+            uint32_t crc1 = 0;
+            uint32_t crc2 = 0;
+
+            for (size_t offset = 0; offset < stride; offset += 8)
+            {
+                memcpy(&words[0], bytes + offset, 8);
+                memcpy(&words[1], bytes + stride + offset, 8);
+                memcpy(&words[2], bytes + 2 * stride + offset, 8);
+                crc0 = crc32c_hardware_word(crc0, words[0]);
+                crc1 = crc32c_hardware_word(crc1, words[1]);
+                crc2 = crc32c_hardware_word(crc2, words[2]);
+            }
+
+            crc = table.shift(table.shift(crc0) ^ crc1) ^ crc2;
+        }
+    }
+
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+        memcpy(&words[0], bytes, 8);
+        crc = crc32c_hardware_word(crc, words[0]);
+    }
+
+    for (; size > 0; ++bytes, --size)
+    {
+        crc = crc32c_hardware_byte(crc, *bytes);
+    }
+
+    return ~crc;
+}
+
+#endif // RAW_CRC32C_HARDWARE
+
+/*
+ * CRC32C of [data, data + size), continuing crc, the CRC of the bytes before:
+ *
+ *      crc32c(b, nb, crc32c(a, na)) == crc32c(a + b)
+ *
+ * the CRC instructions are used if the CPU has them
+ *
+ */
+inline uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0)
+{
+#ifdef RAW_CRC32C_HARDWARE
+    if (has_crc32c_hardware())
+    {
+        return crc32c_hardware(data, size, crc);
+    }
+#endif
+
+    return crc32c_portable(data, size, crc);
+}
+
+/*
+ * incremental checksums:
+ *
+ *      void update(const void* data, size_t size)
+ *      value_type value() const
+ *
+ */
+class RawCrc32c
+{
+public:
+    using value_type = uint32_t;
+
+    RawCrc32c():
+        value_(0)
+    {
+    }
+
+    inline void update(const void* data, size_t size)
+    {
+        value_ = crc32c(data, size, value_);
+    }
+
+    inline value_type value() const
+    {
+        return value_;
+    }
+
+private:
+    value_type value_;
+};
+
+/*
+ * xxHash64, with the bytes of an unfinished stripe kept aside
+ *
+ */
+class RawXxHash64
+{
+public:
+    using value_type = uint64_t;
+
+    explicit RawXxHash64(uint64_t seed = 0):
+        fill_(0), size_(0)
+    {
+        lanes_[0] = seed + prime1 + prime2;
+        lanes_[1] = seed + prime2;
+        lanes_[2] = seed;
+        lanes_[3] = seed - prime1;
+        seed_ = seed;
+    }
+
+    inline void update(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+
+        size_ += size;
+        if (fill_ > 0)
+        {
+            const size_t count = size < 32 - fill_ ? size : 32 - fill_;
+
+            memcpy(stripe_ + fill_, bytes, count);
+            fill_ += count;
+            bytes += count;
+            size -= count;
+            if (fill_ < 32)
+            {
+                return;
+            }
+
+            consume(stripe_);
+            fill_ = 0;
+        }
+
+        for (; size >= 32; bytes += 32, size -= 32)
+        {
+            consume(bytes);
+        }
+
+        memcpy(stripe_, bytes, size);
+        fill_ = size;
+    }
+
+    inline value_type value() const
+    {
+        uint64_t hash;
+
+        if (size_ >= 32)
+        {
+            hash = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) + rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+            for (auto lane: lanes_)
+            {
+                hash = (hash ^ round(0, lane)) * prime1 + prime4;
+            }
+        }
+        else
+        {
+            hash = seed_ + prime5;
+        }
+
+        hash += size_;
+
+        const uint8_t* bytes = stripe_;
+        size_t size = fill_;
+
+        for (; size >= 8; bytes += 8, size -= 8)
+        {
+            hash = rotl(hash ^ round(0, word64(bytes)), 27) * prime1 + prime4;
+        }
+        if (size >= 4)
+        {
+            hash = rotl(hash ^ (word32(bytes) * prime1), 23) * prime2 + prime3;
+            bytes += 4;
+            size -= 4;
+        }
+        for (; size > 0; ++bytes, --size)
+        {
+            hash = rotl(hash ^ (*bytes * prime5), 11) * prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static const uint64_t prime1 = 0x9e3779b185ebca87ull;
+    static const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+    static const uint64_t prime3 = 0x165667b19e3779f9ull;
+    static const uint64_t prime4 = 0x85ebca77c2b2ae63ull;
+    static const uint64_t prime5 = 0x27d4eb2f165667c5ull;
+
+    static inline uint64_t rotl(uint64_t x, int n)
+    {
+        return (x << n) | (x >> (64 - n));
+    }
+
+    static inline uint64_t round(uint64_t lane, uint64_t input)
+    {
+        return rotl(lane + input * prime2, 31) * prime1;
+    }
+
+    static inline uint64_t word64(const uint8_t* bytes)
+    {
+        uint64_t result;
+
+        memcpy(&result, bytes, sizeof(result)); // little endian
+        return result;
+    }
+
+    static inline uint64_t word32(const uint8_t* bytes)
+    {
+        uint32_t result;
+
+        memcpy(&result, bytes, sizeof(result)); // little endian
+        return result;
+    }
+
+    inline void consume(const uint8_t* stripe)
+    {
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            lanes_[lane] = round(lanes_[lane], word64(stripe + 8 * lane));
+        }
+    }
+
+    uint64_t lanes_[4];
+    uint64_t seed_;
+    uint8_t stripe_[32];
+    size_t fill_;
+    uint64_t size_;
+};
+
+/*
+ * hash writer: stream policy updating the checksum TC with the bytes
+ * written, the small writes gathered in place first, as the per-update
+ * cost of a streaming hash outweighs a few bytes, and the large ones in
+ * one update each
+ *
+ * the gathered bytes go to TC on flush()
+ *
+ */
+template <class TC, size_t stage_size = 256>
+class RawHashWriter
+{
+public:
+    explicit RawHashWriter(TC& checksum):
+        checksum_(checksum), fill_(0)
+    {
+    }
+
+    RawHashWriter(const RawHashWriter&) = delete;
+    RawHashWriter& operator=(const RawHashWriter&) = delete;
+
+    inline void write(const void* data, size_t size)
+    {
+        if (size > stage_size - fill_)
+        {
+            flush();
+            if (size >= stage_size)
+            {
+                checksum_.update(data, size);
+                return;
+            }
+        }
+
+        memcpy(stage_ + fill_, data, size);
+        fill_ += size;
+    }
+
+    inline void flush()
+    {
+        if (fill_ > 0)
+        {
+            checksum_.update(stage_, fill_);
+            fill_ = 0;
+        }
+    }
+
+private:
+    TC& checksum_;
+    char stage_[stage_size];
+    size_t fill_;
+};
+
+/*
+ * checksum writer: stream policy passing the bytes to the writer TS and
+ * updating the checksum TC with them in the same pass, while they are hot,
+ * the small writes gathered as RawHashWriter does
+ *
+ * the gathered bytes go to TC on flush()
+ *
+ */
+template <class TS, class TC>
+class RawChecksumWriter
+{
+public:
+    RawChecksumWriter(TS& sink, TC& checksum):
+        sink_(sink), hash_(checksum)
+    {
+    }
+
+    RawChecksumWriter(const RawChecksumWriter&) = delete;
+    RawChecksumWriter& operator=(const RawChecksumWriter&) = delete;
+
+    inline void write(const void* data, size_t size)
+    {
+        sink_.write(data, size);
+        hash_.write(data, size);
+    }
+
+    inline void flush()
+    {
+        hash_.flush();
+    }
+
+private:
+    TS& sink_;
+    RawHashWriter<TC> hash_;
+};
+
+/*
+ * checksum reader: stream policy reading the bytes from the reader TS and
+ * updating the checksum TC with them in the same pass, the limit hooks of
+ * TS are kept
+ *
+ */
+template <class TS, class TC>
+class RawChecksumReader
+{
+public:
+    RawChecksumReader(TS& source, TC& checksum):
+        source_(source), checksum_(checksum)
+    {
+    }
+
+    RawChecksumReader(const RawChecksumReader&) = delete;
+    RawChecksumReader& operator=(const RawChecksumReader&) = delete;
+
+    inline void read(void* data, size_t size)
+    {
+        source_.read(data, size);
+        checksum_.update(data, size);
+    }
+
+    inline size_t admit(size_t size, size_t item_size)
+    {
+        return RawStreamLimits<TS>::admit(source_, size, item_size);
+    }
+
+    inline bool enter()
+    {
+        return RawStreamLimits<TS>::enter(source_);
+    }
+
+    inline void leave()
+    {
+        RawStreamLimits<TS>::leave(source_);
+    }
+
+    inline bool good() const
+    {
+        return source_.good();
+    }
+
+private:
+    TS& source_;
+    TC& checksum_;
+};
+
+/*
+ * serialize object into [data, data + capacity), updating checksum in the
+ * same pass, the serialized size, beyond capacity if it did not fit
+ *
+ */
+template <typename TO, class TC>
+inline size_t serialize_checksummed(char* data, size_t capacity, const TO& object, TC& checksum)
+{
+    RawBoundedWriter writer(data, capacity);
+    RawChecksumWriter<RawBoundedWriter, TC> fused(writer, checksum);
+
+    serialize(make_stream_buffer(fused), object);
+    fused.flush();
+    return writer.size();
+}
+
+/*
+ * deserialize object from [data, data + size), updating checksum in the
+ * same pass, the end of object, or nullptr if it overruns
+ *
+ */
+template <typename TO, class TC>
+inline const char* deserialize_checksummed(const char* data, size_t size, TO& object, TC& checksum)
+{
+    RawMemoryReader reader(data, size);
+    RawChecksumReader<RawMemoryReader, TC> fused(reader, checksum);
+
+    deserialize(make_stream_buffer(fused), object);
+    return reader.good() ? reader.head() : nullptr;
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,501 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+content-defined chunk store: serialized snapshots split by a rolling hash,
+each unique chunk stored once under its SHA-256, a snapshot being a manifest
+of chunk ids
+
+*/
+
+#pragma once
+
+#include <array>
+#include <cerrno>        // for errno
+#include <cstddef>       // for size_t
+#include <cstdint>       // for uint8_t, uint32_t, uint64_t
+#include <cstring>       // for memcpy, memcmp
+#include <string>
+#include <thread>        // for std::thread::hardware_concurrency
+#include <unordered_set>
+#include <utility>       // for std::pair
+#include <vector>
+
+#include <unistd.h> // for access
+
+#include "raw_file.h"
+#include "raw_parallel.h"
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * SHA-256, FIPS 180-4
+ *
+ */
+class RawSha256
+{
+public:
+    using digest_type = std::array<uint8_t, 32>;
+
+    RawSha256()
+    {
+        reset();
+    }
+
+    inline void reset()
+    {
+        static const uint32_t initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+
+        memcpy(state_, initial, sizeof(state_));
+        fill_ = 0;
+        length_ = 0;
+    }
+
+    inline void update(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+
+        length_ += size;
+        if (fill_ > 0)
+        {
+            const size_t count = size < 64 - fill_ ? size : 64 - fill_;
+
+            memcpy(block_ + fill_, bytes, count);
+            fill_ += count;
+            bytes += count;
+            size -= count;
+            if (fill_ < 64)
+            {
+                return;
+            }
+
+            transform(block_);
+            fill_ = 0;
+        }
+
+        for (; size >= 64; bytes += 64, size -= 64)
+        {
+            transform(bytes);
+        }
+
+        memcpy(block_, bytes, size);
+        fill_ = size;
+    }
+
+    // the digest of the bytes so far, the hash must be reset() to be reused
+    inline digest_type digest()
+    {
+        const uint64_t bits = length_ * 8;
+        const uint8_t pad = 0x80;
+        const uint8_t zero = 0;
+        uint8_t tail[8];
+
+        update(&pad, 1);
+        while (fill_ != 56)
+        {
+            update(&zero, 1);
+        }
+
+        for (size_t idx = 0; idx < 8; ++idx)
+        {
+            tail[idx] = uint8_t(bits >> (56 - 8 * idx));
+        }
+        update(tail, 8);
+
+        digest_type result;
+
+        for (size_t idx = 0; idx < 32; ++idx)
+        {
+            result[idx] = uint8_t(state_[idx / 4] >> (24 - 8 * (idx % 4)));
+        }
+
+        return result;
+    }
+
+    static inline digest_type hash(const void* data, size_t size)
+    {
+        RawSha256 sha;
+
+        sha.update(data, size);
+        return sha.digest();
+    }
+
+private:
+    static inline uint32_t rotr(uint32_t x, int n)
+    {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    inline void transform(const uint8_t* block)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        uint32_t w[64];
+
+        for (size_t idx = 0; idx < 16; ++idx)
+        {
+            w[idx] = uint32_t(block[4 * idx]) << 24 | uint32_t(block[4 * idx + 1]) << 16 |
+                    uint32_t(block[4 * idx + 2]) << 8 | uint32_t(block[4 * idx + 3]);
+        }
+        for (size_t idx = 16; idx < 64; ++idx)
+        {
+            const uint32_t s0 = rotr(w[idx - 15], 7) ^ rotr(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+            const uint32_t s1 = rotr(w[idx - 2], 17) ^ rotr(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+
+            w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+        }
+
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+
+        for (size_t idx = 0; idx < 64; ++idx)
+        {
+            const uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            const uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + k[idx] + w[idx];
+            const uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            const uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    uint32_t state_[8];
+    uint8_t block_[64];
+    size_t fill_;
+    uint64_t length_;
+};
+
+/*
+ * content-defined chunking with a gear rolling hash: a chunk ends where the
+ * top bits of the hash of its last 64 bytes are zero, so an insertion only
+ * moves the boundaries around it
+ *
+ * chunks are average_size, a power of 2, on average, bounded to
+ * [average_size / 4, average_size * 8]
+ *
+ */
+class RawChunker
+{
+public:
+    explicit RawChunker(size_t average_size = 1 << 13):
+        min_size_(average_size / 4), max_size_(average_size * 8), shift_(64)
+    {
+        for (size_t size = average_size; size > 1; size >>= 1)
+        {
+            --shift_;
+        }
+    }
+
+    // the size of the chunk at the front of [data, data + size)
+    inline size_t next(const char* data, size_t size) const
+    {
+        const uint64_t* const table = gear();
+        const size_t last = size < max_size_ ? size : max_size_;
+        uint64_t hash = 0;
+
+        for (size_t idx = 0; idx < last; ++idx)
+        {
+            hash = (hash << 1) + table[uint8_t(data[idx])];
+            if (idx >= min_size_ && (hash >> shift_) == 0)
+            {
+                return idx + 1;
+            }
+        }
+
+        return last;
+    }
+
+    // the largest chunk next() gives
+    inline size_t max_size() const
+    {
+        return max_size_;
+    }
+
+private:
+    // 256 pseudo-random words, from splitmix64
+    static inline const uint64_t* gear()
+    {
+        struct Table
+        {
+            uint64_t words[256];
+
+            Table()
+            {
+                uint64_t seed = 0;
+
+                for (auto& word: words)
+                {
+                    uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+
+                    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                    word = z ^ (z >> 31);
+                }
+            }
+        };
+
+        static const Table table;
+
+        return table.words;
+    }
+
+    const size_t min_size_;
+    const size_t max_size_;
+    int shift_;
+};
+
+using RawChunkId = RawSha256::digest_type;
+
+/*
+ * chunk store in a directory:
+ *
+ *      <directory>/<hex of SHA-256>    a chunk, stored once
+ *      <directory>/<name>.manifest     a snapshot: its size, its chunk ids
+ *
+ * chunks are hashed by thread_count threads, the new ones written aside,
+ * synced and renamed into place, the directory synced once for them all,
+ * the manifest last; reading a snapshot checks every chunk against its id
+ *
+ * a snapshot written with a larger average_size still reads back, only
+ * with more reallocations
+ *
+ */
+class RawChunkStore
+{
+public:
+    explicit RawChunkStore(std::string directory, size_t average_size = 1 << 13,
+            size_t thread_count = std::thread::hardware_concurrency()):
+        directory_(std::move(directory)), chunker_(average_size),
+        thread_count_(thread_count > 0 ? thread_count : 1), stored_size_(0)
+    {
+    }
+
+    // store [data, data + size) as the snapshot name, 0, or -1 with errno set
+    inline int put(const std::string& name, const char* data, size_t size)
+    {
+        std::vector<std::pair<size_t, size_t>> chunks; // offset, size
+
+        for (size_t offset = 0; offset < size; )
+        {
+            const size_t count = chunker_.next(data + offset, size - offset);
+
+            chunks.emplace_back(offset, count);
+            offset += count;
+        }
+
+        Manifest manifest(size, std::vector<RawChunkId>(chunks.size()));
+        auto& ids = manifest.second;
+
+        parallel_for(chunks.size(), thread_count_, [&](size_t idx)
+        {
+            ids[idx] = RawSha256::hash(data + chunks[idx].first, chunks[idx].second);
+        });
+
+        std::vector<size_t> fresh; // indices of the chunks to write
+
+        for (size_t idx = 0; idx < chunks.size(); ++idx)
+        {
+            if (known_.insert(ids[idx]).second && access(path_of(ids[idx]).c_str(), F_OK) < 0)
+            {
+                fresh.push_back(idx);
+            }
+        }
+
+        std::vector<int> errors(fresh.size(), 0);
+
+        parallel_for(fresh.size(), thread_count_, [&](size_t idx)
+        {
+            const auto& chunk = chunks[fresh[idx]];
+
+            if (write_file_renamed(path_of(ids[fresh[idx]]), data + chunk.first, chunk.second) < 0)
+            {
+                errors[idx] = errno;
+            }
+        });
+
+        int error = 0;
+
+        for (size_t idx = 0; idx < fresh.size(); ++idx)
+        {
+            if (errors[idx] != 0)
+            {
+                known_.erase(ids[fresh[idx]]);
+                error = errors[idx];
+                continue;
+            }
+
+            stored_size_ += chunks[fresh[idx]].second;
+        }
+
+        if (error != 0)
+        {
+            errno = error;
+            return -1;
+        }
+        if (!fresh.empty() && sync_directory(directory_) < 0)
+        {
+            return -1;
+        }
+
+        std::vector<char> buf(serialized_size(manifest));
+
+        serialize(buf.data(), manifest);
+        return write_file_atomic(directory_ + "/" + name + ".manifest", buf.data(), buf.size());
+    }
+
+    // the content of the snapshot name into buf, 0, or -1 with errno set
+    inline int get(const std::string& name, std::vector<char>& buf) const
+    {
+        std::vector<char> chunk;
+        Manifest manifest;
+
+        if (read_file(directory_ + "/" + name + ".manifest", chunk) < 0)
+        {
+            return -1;
+        }
+
+        const char* const end = chunk.data() + chunk.size();
+
+        if (validate<Manifest>(static_cast<const char*>(chunk.data()), end) != end)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        deserialize(static_cast<const char*>(chunk.data()), manifest);
+
+        // the size claimed is not trusted, but clamped to what the chunks can hold
+        const size_t max_size = chunker_.max_size();
+        const size_t count = manifest.second.size();
+
+        buf.clear();
+        buf.reserve(manifest.first / max_size < count ? manifest.first : count * max_size);
+        for (const auto& id: manifest.second)
+        {
+            if (read_file(path_of(id), chunk) < 0)
+            {
+                return -1;
+            }
+            if (RawSha256::hash(chunk.data(), chunk.size()) != id)
+            {
+                errno = EBADMSG;
+                return -1;
+            }
+
+            buf.insert(buf.end(), chunk.begin(), chunk.end());
+        }
+
+        if (buf.size() != manifest.first)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    // serialize object as the snapshot name, 0, or -1 with errno set
+    template <typename TO>
+    inline int save(const std::string& name, const TO& object)
+    {
+        std::vector<char> buf(serialized_size(object));
+
+        serialize(buf.data(), object);
+        return put(name, buf.data(), buf.size());
+    }
+
+    // deserialize the snapshot name into object, 0, or -1 with errno set
+    template <typename TO>
+    inline int load(const std::string& name, TO& object) const
+    {
+        std::vector<char> buf;
+
+        if (get(name, buf) < 0)
+        {
+            return -1;
+        }
+
+        const char* const end = buf.data() + buf.size();
+
+        if (validate<TO>(static_cast<const char*>(buf.data()), end) != end)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        deserialize(static_cast<const char*>(buf.data()), object);
+        return 0;
+    }
+
+    // bytes of the chunks written by this store
+    inline size_t stored_size() const
+    {
+        return stored_size_;
+    }
+
+private:
+    using Manifest = std::pair<size_t, std::vector<RawChunkId>>; // size, chunk ids
+
+    struct IdHash
+    {
+        inline size_t operator()(const RawChunkId& id) const
+        {
+            size_t result;
+
+            memcpy(&result, id.data(), sizeof(result));
+            return result;
+        }
+    };
+
+    inline std::string path_of(const RawChunkId& id) const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string path = directory_ + "/";
+
+        for (auto byte: id)
+        {
+            path += digits[byte >> 4];
+            path += digits[byte & 0xf];
+        }
+
+        return path;
+    }
+
+    const std::string directory_;
+    const RawChunker chunker_;
+    const size_t thread_count_;
+    std::unordered_set<RawChunkId, IdHash> known_;
+    size_t stored_size_;
+};
+
+} // namespace NAMESPACE
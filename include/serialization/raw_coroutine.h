@@ -0,0 +1,615 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+incremental serialization with C++20 coroutines: the serialization of a
+large object suspends every buffer-full or every N items, and resumes into
+a fresh buffer
+
+the bytes are identical to the serialization in one go
+
+*/
+
+#pragma once
+
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>   // for std::coroutine_handle, std::suspend_always
+#include <cstddef>     // for size_t
+#include <cstring>     // for memcpy
+#include <exception>   // for std::terminate
+#include <memory>      // for std::unique_ptr
+#include <tuple>
+#include <type_traits> // for std::disjunction
+#include <utility>     // for std::pair
+#include <vector>
+
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * types walked item by item, each item in a coroutine of its own:
+ * containers of non-copyable items, and pairs and tuples holding any
+ *
+ */
+template <typename T, typename Test = void>
+struct is_incremental_walkable: std::false_type {};
+
+template <class T>
+struct is_incremental_walkable<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !is_container_block_copyable<T>::value
+        >>: std::true_type {};
+
+template <typename TK, typename TV>
+struct is_incremental_walkable<std::pair<TK, TV>>:
+        std::disjunction<
+            is_incremental_walkable<remove_const_t<TK>>,
+            is_incremental_walkable<TV>> {};
+
+template <typename ...Args>
+struct is_incremental_walkable<std::tuple<Args...>>:
+        std::disjunction<is_incremental_walkable<Args>...> {};
+
+template <typename T>
+struct is_incremental_tuple: std::false_type {};
+
+template <typename TK, typename TV>
+struct is_incremental_tuple<std::pair<TK, TV>>: std::bool_constant<
+        !is_serialization_copyable<std::pair<TK, TV>>::value> {};
+
+template <typename ...Args>
+struct is_incremental_tuple<std::tuple<Args...>>: std::bool_constant<
+        !is_serialization_copyable<std::tuple<Args...>>::value> {};
+
+// std::unique_ptr, its pointee serialized by pieces if larger than the room left
+template <typename T>
+struct is_incremental_pointer: std::false_type {};
+
+template <typename T, typename ...Args>
+struct is_incremental_pointer<std::unique_ptr<T, Args...>>: std::true_type {};
+
+/*
+ * fields of pairs and tuples taking a coroutine of their own: the walkable
+ * ones, and containers of copyable items to be split at buffer boundaries
+ *
+ */
+template <typename T>
+struct is_incremental_field: std::bool_constant<
+        is_incremental_walkable<T>::value ||
+        is_incremental_tuple<T>::value ||
+        is_non_default_serializable_container_type<T>::value> {};
+
+/*
+ * progress shared by the coroutines of one incremental serialization,
+ * and the stream policy of the items serialized in one go
+ *
+ * the bytes of an item beyond the current buffer are spilled, and go first
+ * into the next one; the items larger than the room left are serialized
+ * by pieces instead (see serialize_whole_steps()), so only what is written
+ * in one call spills: a scalar, a size, or an item of a custom serializer
+ *
+ */
+class RawIncrementalState
+{
+public:
+    // suspension point, taken or not
+    struct Awaiter
+    {
+        bool suspend;
+
+        inline bool await_ready() const noexcept
+        {
+            return !suspend;
+        }
+
+        inline void await_suspend(std::coroutine_handle<>) const noexcept
+        {
+        }
+
+        inline void await_resume() const noexcept
+        {
+        }
+    };
+
+    explicit RawIncrementalState(size_t item_quota):
+        item_quota_(item_quota), data_(nullptr), capacity_(0), fill_(0), items_(0),
+        spill_head_(0)
+    {
+    }
+
+    inline void write(const void* data, size_t size)
+    {
+        const size_t count = write_some(data, size);
+
+        spill_.insert(spill_.end(),
+                static_cast<const char*>(data) + count, static_cast<const char*>(data) + size);
+    }
+
+    // copy what fits in the current buffer, the bytes copied
+    inline size_t write_some(const void* data, size_t size)
+    {
+        const size_t count = size < capacity_ - fill_ ? size : capacity_ - fill_;
+
+        if (count > 0)
+        {
+            memcpy(data_ + fill_, data, count);
+            fill_ += count;
+        }
+
+        return count;
+    }
+
+    // start over with a fresh buffer, the spilled bytes first
+    inline void begin(char* data, size_t capacity)
+    {
+        data_ = data;
+        capacity_ = capacity;
+        fill_ = 0;
+        items_ = 0;
+
+        spill_head_ += write_some(spill_.data() + spill_head_, spill_.size() - spill_head_);
+        if (spill_head_ == spill_.size())
+        {
+            spill_.clear();
+            spill_head_ = 0;
+        }
+    }
+
+    inline size_t fill() const
+    {
+        return fill_;
+    }
+
+    inline bool full() const
+    {
+        return fill_ == capacity_;
+    }
+
+    // whether object fits the room left in the current buffer
+    template <typename T>
+    inline bool fits(const T& object) const
+    {
+        return size_t(serialized_size(object)) <= capacity_ - fill_;
+    }
+
+    inline bool spilled() const
+    {
+        return spill_head_ < spill_.size();
+    }
+
+    // bytes spilled, waiting for the next buffer
+    inline size_t pending() const
+    {
+        return spill_.size() - spill_head_;
+    }
+
+    // suspend after an item if the buffer is full or the quota is reached
+    inline Awaiter tick()
+    {
+        ++items_;
+        return Awaiter{ full() || items_ >= item_quota_ };
+    }
+
+    // suspend if the buffer is full
+    inline Awaiter yield()
+    {
+        return Awaiter{ full() };
+    }
+
+    std::coroutine_handle<> active; // the innermost coroutine
+
+private:
+    const size_t item_quota_;
+    char* data_;
+    size_t capacity_;
+    size_t fill_;
+    size_t items_;
+    std::vector<char> spill_;
+    size_t spill_head_;
+};
+
+/*
+ * coroutine task of an incremental serialization step, nested steps are
+ * awaited by symmetric transfer, a suspension goes back to the resumer
+ *
+ */
+class RawIncrementalTask
+{
+public:
+    struct promise_type
+    {
+        RawIncrementalState& state;
+        std::coroutine_handle<> continuation;
+
+        template <typename ...Args>
+        promise_type(RawIncrementalState& state, const Args&...):
+            state(state)
+        {
+        }
+
+        inline RawIncrementalTask get_return_object()
+        {
+            return RawIncrementalTask(handle_type::from_promise(*this));
+        }
+
+        inline std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        inline auto final_suspend() const noexcept
+        {
+            struct Awaiter
+            {
+                inline bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                inline std::coroutine_handle<> await_suspend(handle_type handle) const noexcept
+                {
+                    auto& promise = handle.promise();
+
+                    if (!promise.continuation)
+                    {
+                        return std::noop_coroutine();
+                    }
+
+                    promise.state.active = promise.continuation;
+                    return promise.continuation;
+                }
+
+                inline void await_resume() const noexcept
+                {
+                }
+            };
+
+            return Awaiter{};
+        }
+
+        inline void return_void() const
+        {
+        }
+
+        inline void unhandled_exception() const
+        {
+            std::terminate();
+        }
+    };
+
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    RawIncrementalTask(RawIncrementalTask&& other):
+        handle_(other.handle_)
+    {
+        other.handle_ = nullptr;
+    }
+
+    RawIncrementalTask(const RawIncrementalTask&) = delete;
+    RawIncrementalTask& operator=(const RawIncrementalTask&) = delete;
+
+    ~RawIncrementalTask()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    inline handle_type handle() const
+    {
+        return handle_;
+    }
+
+    // run as a nested step of the awaiting coroutine
+    inline auto operator co_await() const noexcept
+    {
+        struct Awaiter
+        {
+            handle_type handle;
+
+            inline bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) const noexcept
+            {
+                handle.promise().continuation = parent;
+                handle.promise().state.active = handle;
+                return handle;
+            }
+
+            inline void await_resume() const noexcept
+            {
+            }
+        };
+
+        return Awaiter{ handle_ };
+    }
+
+private:
+    explicit RawIncrementalTask(handle_type handle):
+        handle_(handle)
+    {
+    }
+
+    handle_type handle_;
+};
+
+template <typename T>
+RawIncrementalTask serialize_steps(RawIncrementalState& state, const T& object);
+
+template <typename T>
+RawIncrementalTask serialize_whole_steps(RawIncrementalState& state, const T& object);
+
+// the size and the block of contiguous copyable items, split at buffer boundaries
+template <typename T>
+RawIncrementalTask serialize_block_steps(RawIncrementalState& state, const T& object)
+{
+    using TI = value_type_t<T>;
+
+    const size_t size = object.size();
+    auto bytes = reinterpret_cast<const char*>(object.data());
+    size_t rest = sizeof(TI) * size;
+
+    serialize(make_stream_buffer(state), size);
+    while (rest > 0)
+    {
+        co_await state.yield();
+
+        const size_t count = state.write_some(bytes, rest);
+
+        bytes += count;
+        rest -= count;
+    }
+}
+
+template <size_t I, typename TT>
+RawIncrementalTask serialize_whole_tuple_steps(RawIncrementalState& state, const TT& tuple)
+{
+    if constexpr (I < std::tuple_size<TT>::value)
+    {
+        using TF = remove_const_t<std::tuple_element_t<I, TT>>;
+
+        if (state.fits(std::get<I>(tuple)))
+        {
+            serialize(make_stream_buffer(state), std::get<I>(tuple));
+        }
+        else
+        {
+            co_await serialize_whole_steps<TF>(state, std::get<I>(tuple));
+        }
+
+        co_await serialize_whole_tuple_steps<I + 1>(state, tuple);
+    }
+
+    co_return;
+}
+
+/*
+ * an item counted as one, larger than the room left: the same as
+ * serialize_steps(), without the item quota, the parts fitting the room
+ * left in one go, the rest by pieces
+ *
+ */
+template <typename T>
+RawIncrementalTask serialize_whole_steps(RawIncrementalState& state, const T& object)
+{
+    co_await state.yield(); // a fresh buffer if this one is full
+
+    if constexpr (is_incremental_tuple<T>::value)
+    {
+        co_await serialize_whole_tuple_steps<0>(state, object);
+    }
+    else if constexpr (is_non_default_serializable_container_type<T>::value &&
+            is_container_block_copyable<T>::value)
+    {
+        co_await serialize_block_steps(state, object);
+    }
+    else if constexpr (is_non_default_serializable_container_type<T>::value)
+    {
+        using TI = remove_const_t<value_type_t<T>>;
+
+        const size_t size = RawContainerSize<T>()(object);
+
+        serialize(make_stream_buffer(state), size);
+        for (const auto& item: object)
+        {
+            if (state.fits(item))
+            {
+                serialize(make_stream_buffer(state), item);
+            }
+            else
+            {
+                co_await serialize_whole_steps<TI>(state, item);
+            }
+        }
+    }
+    else if constexpr (is_incremental_pointer<T>::value)
+    {
+        using TP = typename T::element_type;
+
+        const bool test = bool(object);
+
+        serialize(make_stream_buffer(state), test);
+        if (test)
+        {
+            if (state.fits(*object))
+            {
+                serialize(make_stream_buffer(state), *object);
+            }
+            else
+            {
+                co_await serialize_whole_steps<TP>(state, *object);
+            }
+        }
+    }
+    else
+    {
+        serialize(make_stream_buffer(state), object);
+    }
+}
+
+template <size_t I, typename TT>
+RawIncrementalTask serialize_tuple_steps(RawIncrementalState& state, const TT& tuple)
+{
+    if constexpr (I < std::tuple_size<TT>::value)
+    {
+        using TF = remove_const_t<std::tuple_element_t<I, TT>>;
+
+        if constexpr (is_incremental_field<TF>::value)
+        {
+            co_await serialize_steps<TF>(state, std::get<I>(tuple));
+        }
+        else
+        {
+            if (state.fits(std::get<I>(tuple)))
+            {
+                serialize(make_stream_buffer(state), std::get<I>(tuple));
+            }
+            else
+            {
+                co_await serialize_whole_steps<TF>(state, std::get<I>(tuple));
+            }
+            co_await state.tick();
+        }
+
+        co_await serialize_tuple_steps<I + 1>(state, tuple);
+    }
+
+    co_return;
+}
+
+/*
+ * the incremental serialization of object:
+ *
+ *      std::pair, std::tuple               field by field
+ *      contiguous copyable items           one block, split at buffer boundaries
+ *      other containers                    item by item
+ *      the rest                            in one go, by pieces if larger
+ *                                          than the room left
+ *
+ */
+template <typename T>
+RawIncrementalTask serialize_steps(RawIncrementalState& state, const T& object)
+{
+    if constexpr (is_incremental_tuple<T>::value)
+    {
+        co_await serialize_tuple_steps<0>(state, object);
+    }
+    else if constexpr (is_non_default_serializable_container_type<T>::value &&
+            is_container_block_copyable<T>::value)
+    {
+        co_await serialize_block_steps(state, object);
+        co_await state.tick();
+    }
+    else if constexpr (is_non_default_serializable_container_type<T>::value)
+    {
+        using TI = remove_const_t<value_type_t<T>>;
+
+        const size_t size = RawContainerSize<T>()(object);
+
+        serialize(make_stream_buffer(state), size);
+        for (const auto& item: object)
+        {
+            if constexpr (is_incremental_walkable<TI>::value)
+            {
+                co_await serialize_steps<TI>(state, item);
+            }
+            else
+            {
+                if (state.fits(item))
+                {
+                    serialize(make_stream_buffer(state), item);
+                }
+                else
+                {
+                    co_await serialize_whole_steps<TI>(state, item);
+                }
+                co_await state.tick();
+            }
+        }
+    }
+    else
+    {
+        if (state.fits(object))
+        {
+            serialize(make_stream_buffer(state), object);
+        }
+        else
+        {
+            co_await serialize_whole_steps<T>(state, object);
+        }
+        co_await state.tick();
+    }
+}
+
+/*
+ * incremental serializer: object is serialized by pieces on resume()
+ *
+ *      RawIncrementalSerializer<T> serializer(object, item_quota);
+ *      while (!serializer.done())
+ *      {
+ *          size = serializer.resume(data, capacity);
+ *          // send [data, data + size), serve other requests ...
+ *      }
+ *
+ * every resume() fills a fresh buffer, suspending when it is full or after
+ * item_quota items, a copyable block counting as one
+ * the last resume() may find nothing left and return 0
+ * object must not be modified until done()
+ *
+ * the items larger than the room left, i.e. long strings, go by pieces as
+ * well, a buffer at a time, only the bytes of one write call beyond the
+ * buffer being kept for the next resume()
+ *
+ */
+template <typename TO>
+class RawIncrementalSerializer
+{
+public:
+    explicit RawIncrementalSerializer(const TO& object, size_t item_quota = ~size_t(0)):
+        state_(item_quota), task_(serialize_steps<TO>(state_, object))
+    {
+        state_.active = task_.handle();
+    }
+
+    RawIncrementalSerializer(const RawIncrementalSerializer&) = delete;
+    RawIncrementalSerializer& operator=(const RawIncrementalSerializer&) = delete;
+
+    // serialize the next bytes into data[0, capacity), the bytes written
+    inline size_t resume(char* data, size_t capacity)
+    {
+        state_.begin(data, capacity);
+        if (!state_.full() && !task_.handle().done())
+        {
+            state_.active.resume();
+        }
+
+        return state_.fill();
+    }
+
+    inline bool done() const
+    {
+        return task_.handle().done() && !state_.spilled();
+    }
+
+    // bytes serialized beyond the last buffer, for the next resume()
+    inline size_t pending() const
+    {
+        return state_.pending();
+    }
+
+private:
+    RawIncrementalState state_;
+    RawIncrementalTask task_;
+};
+
+} // namespace NAMESPACE
+
+#endif // __cpp_impl_coroutine
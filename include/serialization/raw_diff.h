@@ -0,0 +1,620 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+structural diff and patch: the changes between two versions of an object,
+as inserted, changed and erased entries of maps and sets and changed ranges
+of vectors, to be serialized and applied to a live object in place
+
+*/
+
+#pragma once
+
+#include <algorithm>   // for std::copy
+#include <cstddef>     // for size_t
+#include <cstring>     // for memcmp
+#include <iterator>    // for std::iterator_traits, std::random_access_iterator_tag
+#include <memory>      // for std::unique_ptr
+#include <tuple>
+#include <type_traits> // for std::is_same, std::is_base_of, std::is_copy_assignable
+#include <utility>     // for std::pair, std::declval, std::move
+#include <vector>
+
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * sequences patched by ranges of items: containers of random access with
+ * resize(), std::vector, std::deque, std::string ...
+ *
+ */
+template <typename T, typename Test = void>
+struct is_diff_sequence: std::false_type {};
+
+template <class T>
+struct is_diff_sequence<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value &&
+            std::is_base_of<std::random_access_iterator_tag,
+                    typename std::iterator_traits<typename T::iterator>::iterator_category>::value
+        >>: std::true_type {};
+
+/*
+ * associative containers of unique keys, patched entry by entry:
+ * std::map, std::unordered_map, std::set, std::unordered_set ...
+ *
+ */
+template <typename T, typename Test = void>
+struct is_diff_unique_associative: std::false_type {};
+
+template <class T>
+struct is_diff_unique_associative<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            std::is_same<
+                decltype(std::declval<T&>().insert(std::declval<const value_type_t<T>&>())),
+                std::pair<typename T::iterator, bool>
+            >::value
+        >>: std::true_type {};
+
+template <typename T, typename Test = void>
+struct is_diff_map: std::false_type {};
+
+template <class T>
+struct is_diff_map<T,
+        enable_if_t<
+            is_diff_unique_associative<T>::value &&
+            !std::is_same<typename T::key_type, value_type_t<T>>::value
+        >>: std::true_type {};
+
+template <class T>
+using is_diff_set = conditional_and_t<
+        is_diff_unique_associative<T>::value,
+        !is_diff_map<T>::value>;
+
+/*
+ * equality as the diff sees it: the bytes of serialization-copyable types,
+ * the pointees of std::unique_ptr, operator== of the rest
+ *
+ */
+template <typename T, typename Test = void>
+struct RawEqual
+{
+    inline bool operator()(const T& lhs, const T& rhs) const
+    {
+        return lhs == rhs;
+    }
+};
+
+template <typename T>
+struct RawEqual<T,
+        enable_if_t<
+            is_serialization_copyable<T>::value
+        >>
+{
+    inline bool operator()(const T& lhs, const T& rhs) const
+    {
+        return memcmp(&lhs, &rhs, sizeof(T)) == 0;
+    }
+};
+
+// std::unique_ptr: both null, or equal pointees, not the same address
+template <typename T, typename ...Args>
+struct RawEqual<std::unique_ptr<T, Args...>>
+{
+    inline bool operator()(const std::unique_ptr<T, Args...>& lhs,
+            const std::unique_ptr<T, Args...>& rhs) const
+    {
+        if (!lhs || !rhs)
+        {
+            return !lhs && !rhs;
+        }
+
+        return RawEqual<T>()(*lhs, *rhs);
+    }
+};
+
+/*
+ * copy of source into target, or of [first, last) to out, through the
+ * serializer for the move-only types, such as std::unique_ptr
+ *
+ */
+template <typename TO, typename Test = void>
+struct RawCopier
+{
+    inline void operator()(TO& target, const TO& source) const
+    {
+        std::vector<char> buf(serialized_size(source));
+
+        serialize(buf.data(), source);
+        deserialize(static_cast<const char*>(buf.data()), target);
+    }
+
+    template <class TI, class TT>
+    inline void operator()(TI first, TI last, TT out) const
+    {
+        for (; first != last; ++first, ++out)
+        {
+            (*this)(*out, *first);
+        }
+    }
+};
+
+template <typename TO>
+struct RawCopier<TO,
+        enable_if_t<
+            std::is_copy_assignable<TO>::value
+        >>
+{
+    inline void operator()(TO& target, const TO& source) const
+    {
+        target = source;
+    }
+
+    template <class TI, class TT>
+    inline void operator()(TI first, TI last, TT out) const
+    {
+        std::copy(first, last, out);
+    }
+};
+
+/*
+ * the patch from old_object to new_object, true if they differ
+ *
+ * the rest: the new value as a whole, nullptr if unchanged
+ *
+ */
+template <typename TO, typename Test = void>
+struct RawDiffer
+{
+    using patch_type = std::unique_ptr<TO>;
+
+    inline bool operator()(const TO& old_object, const TO& new_object, patch_type& patch) const
+    {
+        if (RawEqual<TO>()(old_object, new_object))
+        {
+            patch.reset();
+            return false;
+        }
+
+        patch.reset(new TO());
+        RawCopier<TO>()(*patch, new_object);
+        return true;
+    }
+};
+
+/*
+ * apply patch to object in place, false if it does not fit object, which
+ * is then not the version the patch was taken from; what fits is applied
+ *
+ * only the shape is checked, sizes and keys, not the values replaced
+ *
+ */
+template <typename TO, typename Test = void>
+struct RawPatcher
+{
+    inline bool operator()(TO& object, const typename RawDiffer<TO>::patch_type& patch) const
+    {
+        if (patch)
+        {
+            RawCopier<TO>()(object, *patch);
+        }
+
+        return true;
+    }
+};
+
+template <typename TO>
+using raw_patch_t = typename RawDiffer<TO>::patch_type;
+
+// std::pair, field by field
+template <typename TK, typename TV>
+struct RawDiffer<std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    using patch_type = std::pair<raw_patch_t<TK>, raw_patch_t<TV>>;
+
+    inline bool operator()(const std::pair<TK, TV>& old_object,
+            const std::pair<TK, TV>& new_object, patch_type& patch) const
+    {
+        const bool changed = RawDiffer<TK>()(old_object.first, new_object.first, patch.first);
+
+        return RawDiffer<TV>()(old_object.second, new_object.second, patch.second) || changed;
+    }
+};
+
+template <typename TK, typename TV>
+struct RawPatcher<std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    inline bool operator()(std::pair<TK, TV>& object,
+            const raw_patch_t<std::pair<TK, TV>>& patch) const
+    {
+        const bool fit = RawPatcher<TK>()(object.first, patch.first);
+
+        return RawPatcher<TV>()(object.second, patch.second) && fit;
+    }
+};
+
+// std::tuple, field by field
+template <size_t I, typename TT>
+struct RawTupleDiffHelper
+{
+    using TF = tuple_element_t<I - 1, TT>;
+
+    template <typename TP>
+    static inline bool diff(const TT& old_object, const TT& new_object, TP& patch)
+    {
+        const bool changed = RawTupleDiffHelper<I - 1, TT>::diff(old_object, new_object, patch);
+
+        return RawDiffer<TF>()(std::get<I - 1>(old_object), std::get<I - 1>(new_object),
+                std::get<I - 1>(patch)) || changed;
+    }
+
+    template <typename TP>
+    static inline bool apply(TT& object, const TP& patch)
+    {
+        const bool fit = RawTupleDiffHelper<I - 1, TT>::apply(object, patch);
+
+        return RawPatcher<TF>()(std::get<I - 1>(object), std::get<I - 1>(patch)) && fit;
+    }
+};
+
+template <typename TT>
+struct RawTupleDiffHelper<0, TT>
+{
+    template <typename TP>
+    static inline bool diff(const TT& /*old_object*/, const TT& /*new_object*/, TP& /*patch*/)
+    {
+        return false;
+    }
+
+    template <typename TP>
+    static inline bool apply(TT& /*object*/, const TP& /*patch*/)
+    {
+        return true;
+    }
+};
+
+template <typename ...Args>
+struct RawDiffer<std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    using patch_type = std::tuple<raw_patch_t<Args>...>;
+
+    inline bool operator()(const std::tuple<Args...>& old_object,
+            const std::tuple<Args...>& new_object, patch_type& patch) const
+    {
+        return RawTupleDiffHelper<sizeof...(Args), std::tuple<Args...>>::diff(
+                old_object, new_object, patch);
+    }
+};
+
+template <typename ...Args>
+struct RawPatcher<std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    inline bool operator()(std::tuple<Args...>& object,
+            const raw_patch_t<std::tuple<Args...>>& patch) const
+    {
+        return RawTupleDiffHelper<sizeof...(Args), std::tuple<Args...>>::apply(object, patch);
+    }
+};
+
+/*
+ * sequences: the old size, the new size, and the changed ranges of items
+ * as (index, items)
+ *
+ * runs of changed items merge across gaps of unchanged copyable ones no
+ * larger than a range header
+ *
+ */
+template <class TO>
+struct RawDiffer<TO,
+        enable_if_t<
+            is_diff_sequence<TO>::value
+        >>
+{
+    using TI = value_type_t<TO>;
+    using patch_type = std::tuple<size_t, size_t, std::vector<std::pair<size_t, std::vector<TI>>>>;
+
+    static constexpr size_t merge_gap = is_serialization_copyable<TI>::value ?
+            2 * sizeof(size_t) / sizeof(TI) : 0;
+
+    inline bool operator()(const TO& old_object, const TO& new_object, patch_type& patch) const
+    {
+        const size_t size = new_object.size();
+        const size_t common = old_object.size() < size ? old_object.size() : size;
+        auto& ranges = std::get<2>(patch);
+
+        std::get<0>(patch) = old_object.size();
+        std::get<1>(patch) = size;
+        ranges.clear();
+
+        size_t idx = 0;
+
+        while (idx < common)
+        {
+            if (RawEqual<TI>()(old_object[idx], new_object[idx]))
+            {
+                ++idx;
+                continue;
+            }
+
+            const size_t first = idx;
+            size_t last = ++idx; // past the last changed item
+
+            while (idx < common && idx - last <= merge_gap)
+            {
+                if (!RawEqual<TI>()(old_object[idx], new_object[idx]))
+                {
+                    last = idx + 1;
+                }
+
+                ++idx;
+            }
+
+            ranges.emplace_back(first, std::vector<TI>(last - first));
+            RawCopier<TI>()(new_object.begin() + first, new_object.begin() + last,
+                    ranges.back().second.begin());
+        }
+
+        // the appended items, with the last range if close enough
+        if (size > common)
+        {
+            if (!ranges.empty() &&
+                    common - ranges.back().first - ranges.back().second.size() <= merge_gap)
+            {
+                auto& items = ranges.back().second;
+                const size_t offset = items.size();
+
+                items.resize(size - ranges.back().first);
+                RawCopier<TI>()(new_object.begin() + (ranges.back().first + offset),
+                        new_object.end(), items.begin() + offset);
+            }
+            else
+            {
+                ranges.emplace_back(common, std::vector<TI>(size - common));
+                RawCopier<TI>()(new_object.begin() + common, new_object.end(),
+                        ranges.back().second.begin());
+            }
+        }
+
+        return size != old_object.size() || !ranges.empty();
+    }
+};
+
+template <class TO>
+struct RawPatcher<TO,
+        enable_if_t<
+            is_diff_sequence<TO>::value
+        >>
+{
+    inline bool operator()(TO& object, const raw_patch_t<TO>& patch) const
+    {
+        bool fit = object.size() == std::get<0>(patch);
+
+        object.resize(std::get<1>(patch));
+        for (const auto& range: std::get<2>(patch))
+        {
+            if (range.first > object.size() || range.second.size() > object.size() - range.first)
+            {
+                fit = false;
+                continue;
+            }
+
+            RawCopier<value_type_t<TO>>()(range.second.begin(), range.second.end(),
+                    object.begin() + range.first);
+        }
+
+        return fit;
+    }
+};
+
+/*
+ * maps: the inserted entries, the changed entries as (key, value patch),
+ * and the erased keys
+ *
+ */
+template <class TO>
+struct RawDiffer<TO,
+        enable_if_t<
+            is_diff_map<TO>::value
+        >>
+{
+    using TK = typename TO::key_type;
+    using TV = typename TO::mapped_type;
+    using patch_type = std::tuple<
+            std::vector<std::pair<TK, TV>>,
+            std::vector<std::pair<TK, raw_patch_t<TV>>>,
+            std::vector<TK>>;
+
+    inline bool operator()(const TO& old_object, const TO& new_object, patch_type& patch) const
+    {
+        auto& inserted = std::get<0>(patch);
+        auto& changed = std::get<1>(patch);
+        auto& erased = std::get<2>(patch);
+
+        inserted.clear();
+        changed.clear();
+        erased.clear();
+
+        for (const auto& item: new_object)
+        {
+            const auto old_item = old_object.find(item.first);
+
+            if (old_item == old_object.end())
+            {
+                inserted.emplace_back(item.first, TV());
+                RawCopier<TV>()(inserted.back().second, item.second);
+                continue;
+            }
+
+            raw_patch_t<TV> value_patch;
+
+            if (RawDiffer<TV>()(old_item->second, item.second, value_patch))
+            {
+                changed.emplace_back(item.first, std::move(value_patch));
+            }
+        }
+
+        for (const auto& item: old_object)
+        {
+            if (new_object.find(item.first) == new_object.end())
+            {
+                erased.push_back(item.first);
+            }
+        }
+
+        return !inserted.empty() || !changed.empty() || !erased.empty();
+    }
+};
+
+template <class TO>
+struct RawPatcher<TO,
+        enable_if_t<
+            is_diff_map<TO>::value
+        >>
+{
+    using TV = typename TO::mapped_type;
+
+    inline bool operator()(TO& object, const raw_patch_t<TO>& patch) const
+    {
+        bool fit = true;
+
+        for (const auto& key: std::get<2>(patch))
+        {
+            fit = object.erase(key) > 0 && fit;
+        }
+
+        for (const auto& item: std::get<1>(patch))
+        {
+            const auto found = object.find(item.first);
+
+            if (found == object.end())
+            {
+                fit = false;
+                continue;
+            }
+
+            fit = RawPatcher<TV>()(found->second, item.second) && fit;
+        }
+
+        for (const auto& item: std::get<0>(patch))
+        {
+            const auto result = object.emplace(item.first, TV());
+
+            RawCopier<TV>()(result.first->second, item.second);
+            fit = result.second && fit;
+        }
+
+        return fit;
+    }
+};
+
+// sets: the inserted keys, and the erased keys
+template <class TO>
+struct RawDiffer<TO,
+        enable_if_t<
+            is_diff_set<TO>::value
+        >>
+{
+    using TK = typename TO::key_type;
+    using patch_type = std::tuple<std::vector<TK>, std::vector<TK>>;
+
+    inline bool operator()(const TO& old_object, const TO& new_object, patch_type& patch) const
+    {
+        auto& inserted = std::get<0>(patch);
+        auto& erased = std::get<1>(patch);
+
+        inserted.clear();
+        erased.clear();
+
+        for (const auto& key: new_object)
+        {
+            if (old_object.find(key) == old_object.end())
+            {
+                inserted.push_back(key);
+            }
+        }
+
+        for (const auto& key: old_object)
+        {
+            if (new_object.find(key) == new_object.end())
+            {
+                erased.push_back(key);
+            }
+        }
+
+        return !inserted.empty() || !erased.empty();
+    }
+};
+
+template <class TO>
+struct RawPatcher<TO,
+        enable_if_t<
+            is_diff_set<TO>::value
+        >>
+{
+    inline bool operator()(TO& object, const raw_patch_t<TO>& patch) const
+    {
+        bool fit = true;
+
+        for (const auto& key: std::get<1>(patch))
+        {
+            fit = object.erase(key) > 0 && fit;
+        }
+
+        for (const auto& key: std::get<0>(patch))
+        {
+            fit = object.insert(key).second && fit;
+        }
+
+        return fit;
+    }
+};
+
+/*
+ * the patch turning old_object into new_object, serializable as any object:
+ *
+ *      auto patch = diff(old_state, state);
+ *      serialize(buf, patch);                  // ship it
+ *      ...
+ *      raw_patch_t<State> patch;
+ *      deserialize(buf, patch);
+ *      apply_patch(patch, follower_state);
+ *
+ */
+template <typename TO>
+inline raw_patch_t<TO> diff(const TO& old_object, const TO& new_object)
+{
+    raw_patch_t<TO> patch;
+
+    RawDiffer<TO>()(old_object, new_object, patch);
+    return patch;
+}
+
+/*
+ * apply patch to object in place, false if object is detectably not the
+ * version the patch was taken from: a sequence of another size, a key
+ * missing or already there
+ *
+ */
+template <typename TO>
+inline bool apply_patch(const raw_patch_t<TO>& patch, TO& object)
+{
+    return RawPatcher<TO>()(object, patch);
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,172 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+whole-file helpers of the on-disk stores: durable replacement, reading and
+directory sync
+
+*/
+
+#pragma once
+
+#include <cerrno>  // for errno
+#include <cstddef> // for size_t
+#include <string>
+#include <vector>
+
+#include <fcntl.h>     // for open, O_*
+#include <stdio.h>     // for rename
+#include <sys/stat.h>  // for fstat
+#include <sys/types.h> // for ssize_t
+#include <unistd.h>    // for read, write, fsync, close
+
+namespace NAMESPACE
+{
+
+// sync the entries of directory, new and renamed files, 0, or -1 with errno set
+inline int sync_directory(const std::string& directory)
+{
+    const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fsync(fd) < 0)
+    {
+        const int error = errno;
+
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    return close(fd);
+}
+
+// the directory holding path, "." for a bare name
+inline std::string parent_directory(const std::string& path)
+{
+    const size_t slash = path.rfind('/');
+
+    return slash == std::string::npos ? std::string(".") :
+            slash == 0 ? std::string("/") : path.substr(0, slash);
+}
+
+/*
+ * replace path with [data, data + size): written to "<path>.tmp", synced
+ * and renamed into place, the directory left for the caller to sync, once
+ * for many files
+ * 0, or -1 with errno set
+ *
+ */
+inline int write_file_renamed(const std::string& path, const char* data, size_t size)
+{
+    const std::string temp_path = path + ".tmp";
+    const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    while (size > 0)
+    {
+        const ssize_t count = ::write(fd, data, size);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            const int error = errno;
+
+            close(fd);
+            errno = error;
+            return -1;
+        }
+
+        data += count;
+        size -= size_t(count);
+    }
+
+    if (fsync(fd) < 0)
+    {
+        const int error = errno;
+
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    if (close(fd) < 0)
+    {
+        return -1;
+    }
+
+    return rename(temp_path.c_str(), path.c_str());
+}
+
+/*
+ * replace path with [data, data + size): written to "<path>.tmp", synced
+ * and renamed into place, the directory synced after, so path holds either
+ * the old or the new content
+ * 0, or -1 with errno set
+ *
+ */
+inline int write_file_atomic(const std::string& path, const char* data, size_t size)
+{
+    if (write_file_renamed(path, data, size) < 0)
+    {
+        return -1;
+    }
+
+    return sync_directory(parent_directory(path));
+}
+
+// the content of path into buf, 0, or -1 with errno set
+inline int read_file(const std::string& path, std::vector<char>& buf)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &info) < 0)
+    {
+        const int error = errno;
+
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    size_t size = 0;
+
+    buf.resize(size_t(info.st_size));
+    while (size < buf.size())
+    {
+        const ssize_t count = ::read(fd, buf.data() + size, buf.size() - size);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            const int error = count < 0 ? errno : EIO;
+
+            close(fd);
+            errno = error;
+            return -1;
+        }
+
+        size += size_t(count);
+    }
+
+    return close(fd);
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,331 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+length-prefixed message framing over stream sockets
+
+*/
+
+#pragma once
+
+#include <cerrno>   // for errno
+#include <chrono>   // for std::chrono::steady_clock
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint32_t, UINT32_MAX
+#include <cstring>  // for memcpy
+#include <vector>
+
+#include <sys/socket.h> // for send, recv
+#include <sys/types.h>  // for ssize_t
+
+#include "raw.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * frame layout:
+ *
+ *      | uint32_t size | uint32_t type | payload[size] |
+ *
+ */
+struct RawFrameHeader
+{
+    uint32_t size;
+    uint32_t type;
+};
+
+/*
+ * batching frame writer
+ *
+ * frames are coalesced into one buffer and sent with a single syscall once
+ * the buffer holds flush_size bytes or the oldest frame is older than
+ * flush_delay, event loops should call poll() when idle to honor the deadline
+ *
+ * write errors are reported as false with errno set, EAGAIN on non-blocking
+ * sockets is not an error: the unsent bytes stay buffered
+ *
+ */
+class RawFrameWriter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit RawFrameWriter(int fd,
+            size_t flush_size = 64 << 10,
+            clock::duration flush_delay = std::chrono::milliseconds(1)):
+        fd_(fd), flush_size_(flush_size), flush_delay_(flush_delay),
+        begin_(0)
+    {
+        batch_.reserve(flush_size_);
+    }
+
+    ~RawFrameWriter()
+    {
+        flush();
+    }
+
+    RawFrameWriter(const RawFrameWriter&) = delete;
+    RawFrameWriter& operator=(const RawFrameWriter&) = delete;
+
+    // bytes buffered and not sent yet
+    inline size_t pending() const
+    {
+        return batch_.size() - begin_;
+    }
+
+    // when the buffered frames are due, meaningless if none is pending
+    inline clock::time_point deadline() const
+    {
+        return deadline_;
+    }
+
+    // serialize a frame into the batch, flush if due, EMSGSIZE past 4G bytes
+    template <typename TO>
+    inline bool write(uint32_t type, const TO& object)
+    {
+        const size_t size = serialized_size(object);
+
+        if (size > UINT32_MAX)
+        {
+            errno = EMSGSIZE;
+            return false;
+        }
+
+        RawFrameHeader header = { uint32_t(size), type };
+
+        if (pending() == 0)
+        {
+            deadline_ = clock::now() + flush_delay_;
+        }
+
+        const size_t offset = batch_.size();
+
+        batch_.resize(offset + sizeof(RawFrameHeader) + size);
+        serialize(serialize(&batch_[offset], header), object);
+
+        return batch_.size() - begin_ >= flush_size_ ? flush() : poll();
+    }
+
+    // flush if the deadline has passed
+    inline bool poll()
+    {
+        return pending() > 0 && clock::now() >= deadline_ ? flush() : true;
+    }
+
+    // send as much of the batch as the socket takes
+    inline bool flush()
+    {
+        while (begin_ < batch_.size())
+        {
+            const auto count = ::send(fd_, &batch_[begin_], batch_.size() - begin_,
+                    MSG_NOSIGNAL);
+
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                compact();
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+
+            begin_ += size_t(count);
+        }
+
+        batch_.clear();
+        begin_ = 0;
+        return true;
+    }
+
+private:
+    inline void compact()
+    {
+        batch_.erase(batch_.begin(), batch_.begin() + begin_);
+        begin_ = 0;
+    }
+
+    const int fd_;
+    const size_t flush_size_;
+    const clock::duration flush_delay_;
+
+    std::vector<char> batch_;
+    size_t begin_;
+    clock::time_point deadline_;
+};
+
+/*
+ * reassembling frame reader
+ *
+ * bytes come from fill() on the socket or feed() from elsewhere, complete
+ * frames are then taken out with peek()/release() or read()
+ *
+ * a frame announcing more than max_size bytes makes the reader bad()
+ *
+ */
+class RawFrameReader
+{
+public:
+    explicit RawFrameReader(int fd = -1, size_t max_size = 64 << 20):
+        fd_(fd), max_size_(max_size),
+        buffer_(sizeof(RawFrameHeader) + 4096),
+        begin_(0), end_(0), pending_(0), bad_(false)
+    {
+    }
+
+    RawFrameReader(const RawFrameReader&) = delete;
+    RawFrameReader& operator=(const RawFrameReader&) = delete;
+
+    inline bool bad() const
+    {
+        return bad_;
+    }
+
+    /*
+     * one recv() into the reassembly buffer
+     * bytes read, 0 on end of stream, -1 with errno set on error
+     *
+     */
+    inline ssize_t fill()
+    {
+        reserve(demand());
+
+        ssize_t count;
+        do
+        {
+            count = ::recv(fd_, &buffer_[end_], buffer_.size() - end_, 0);
+        }
+        while (count < 0 && errno == EINTR);
+
+        if (count > 0)
+        {
+            end_ += size_t(count);
+        }
+
+        return count;
+    }
+
+    // append bytes received by other means
+    inline void feed(const char* data, size_t size)
+    {
+        reserve(size);
+        memcpy(&buffer_[end_], data, size);
+        end_ += size;
+    }
+
+    /*
+     * the next complete frame, its type and payload size
+     * nullptr if incomplete, valid until release() or the next fill()/feed()
+     *
+     */
+    inline const char* peek(uint32_t& type, size_t& size)
+    {
+        RawFrameHeader header;
+
+        if (bad_ || end_ - begin_ < sizeof(RawFrameHeader))
+        {
+            return nullptr;
+        }
+
+        const auto buffer = deserialize(&buffer_[begin_], header);
+
+        if (header.size > max_size_)
+        {
+            bad_ = true;
+            return nullptr;
+        }
+
+        if (end_ - begin_ < sizeof(RawFrameHeader) + header.size)
+        {
+            return nullptr;
+        }
+
+        type = header.type;
+        size = header.size;
+        pending_ = sizeof(RawFrameHeader) + header.size;
+        return buffer;
+    }
+
+    // drop the last peeked frame
+    inline void release()
+    {
+        begin_ += pending_;
+        pending_ = 0;
+
+        if (begin_ == end_)
+        {
+            begin_ = end_ = 0;
+        }
+    }
+
+    // deserialize the next complete frame, false if there is none
+    template <typename TO>
+    inline bool read(uint32_t& type, TO& object)
+    {
+        size_t size;
+        const auto buffer = peek(type, size);
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        deserialize(buffer, object);
+        release();
+        return true;
+    }
+
+private:
+    // bytes still missing for the next frame, at least a page for small frames
+    inline size_t demand() const
+    {
+        RawFrameHeader header;
+        size_t size = sizeof(RawFrameHeader);
+
+        if (end_ - begin_ >= sizeof(RawFrameHeader))
+        {
+            deserialize(&buffer_[begin_], header);
+            if (header.size <= max_size_)
+            {
+                size += header.size;
+            }
+        }
+
+        size = size > end_ - begin_ ? size - (end_ - begin_) : 0;
+        return size > 4096 ? size : 4096;
+    }
+
+    // make room for size more bytes, moving the unread bytes to the front
+    inline void reserve(size_t size)
+    {
+        if (buffer_.size() - end_ >= size)
+        {
+            return;
+        }
+
+        if (begin_ > 0)
+        {
+            memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+
+        if (buffer_.size() - end_ < size)
+        {
+            buffer_.resize(end_ + size);
+        }
+    }
+
+    const int fd_;
+    const size_t max_size_;
+
+    std::vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+    size_t pending_;
+    bool bad_;
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,62 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+structural hashing: the serialized bytes of an object fed to a streaming
+hash as they are produced, without a buffer
+
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+
+#include "raw_checksum.h" // for RawHashWriter, RawXxHash64
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * xxHash64 of the serialized bytes of object, the same as hashing the
+ * output of serialize(), without the allocation
+ *
+ * equal objects hash equal as long as they serialize to equal bytes: not
+ * so for the unordered containers iterated in different orders, see
+ * canonical_hash() in raw_canonical.h, nor for 0. and -0. or the padding
+ * of copyable structures
+ *
+ */
+template <typename TO>
+inline uint64_t structural_hash(const TO& object, uint64_t seed = 0)
+{
+    RawXxHash64 checksum(seed);
+    RawHashWriter<RawXxHash64> writer(checksum);
+
+    serialize(make_stream_buffer(writer), object);
+    writer.flush();
+    return checksum.value();
+}
+
+/*
+ * hash functor over structural_hash(), i.e.
+ *
+ *      std::unordered_map<std::tuple<std::string, int>, TV, RawHash<...>>
+ *
+ * not std::hash compatible for every TO: the keys equal under operator==
+ * must serialize to equal bytes, which rules out the keys holding floating
+ * point values (0. == -0.), copyable structures with padding, or unordered
+ * containers, lookups of which would silently miss
+ *
+ */
+template <typename TO>
+struct RawHash
+{
+    inline size_t operator()(const TO& object) const
+    {
+        return size_t(structural_hash(object));
+    }
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,173 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+decode-time resource limits for untrusted input
+
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <cstring> // for memcpy, memset
+
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * limits on what one deserialization may allocate
+ *
+ */
+struct RawDecodeLimits
+{
+    size_t max_allocation;  // bytes of items in total, sizeof(TI) * size per container
+    size_t max_length;      // items per container
+    size_t max_depth;       // nesting of item-wise containers and pointers
+};
+
+/*
+ * memory reader: stream policy reading [data, data + size)
+ * an overrun reads as zeros and makes the reader !good()
+ *
+ */
+class RawMemoryReader
+{
+public:
+    RawMemoryReader(const char* data, size_t size):
+        head_(data), end_(data + size), good_(true)
+    {
+    }
+
+    inline void read(void* data, size_t size)
+    {
+        if (size > size_t(end_ - head_))
+        {
+            memset(data, 0, size);
+            head_ = end_;
+            good_ = false;
+            return;
+        }
+
+        memcpy(data, head_, size);
+        head_ += size;
+    }
+
+    // the next byte to read
+    inline const char* head() const
+    {
+        return head_;
+    }
+
+    inline bool good() const
+    {
+        return good_;
+    }
+
+private:
+    const char* head_;
+    const char* const end_;
+    bool good_;
+};
+
+/*
+ * limited reader: stream policy enforcing RawDecodeLimits over a reader TS
+ * with bool TS.good()
+ *
+ * a size or level beyond the limits fails the reader at once: nothing more
+ * is read from TS, every read is zeros and every container decodes empty,
+ * so the deserialization unwinds in no more steps than the current depth
+ *
+ */
+template <class TS>
+class RawLimitedReader
+{
+public:
+    RawLimitedReader(TS& source, const RawDecodeLimits& limits):
+        source_(source), limits_(limits), allocation_(0), depth_(0), good_(true)
+    {
+    }
+
+    RawLimitedReader(const RawLimitedReader&) = delete;
+    RawLimitedReader& operator=(const RawLimitedReader&) = delete;
+
+    inline void read(void* data, size_t size)
+    {
+        if (!good_)
+        {
+            memset(data, 0, size);
+            return;
+        }
+
+        source_.read(data, size);
+        good_ = source_.good();
+    }
+
+    inline size_t admit(size_t size, size_t item_size)
+    {
+        if (good_ && size <= limits_.max_length &&
+                (item_size == 0 || size <= (limits_.max_allocation - allocation_) / item_size))
+        {
+            allocation_ += item_size * size;
+            return size;
+        }
+
+        good_ = false;
+        return 0;
+    }
+
+    inline bool enter()
+    {
+        if (++depth_ > limits_.max_depth)
+        {
+            good_ = false;
+        }
+
+        return good_;
+    }
+
+    inline void leave()
+    {
+        --depth_;
+    }
+
+    // bytes of items admitted so far
+    inline size_t allocation() const
+    {
+        return allocation_;
+    }
+
+    inline bool good() const
+    {
+        return good_;
+    }
+
+private:
+    TS& source_;
+    const RawDecodeLimits limits_;
+    size_t allocation_;
+    size_t depth_;
+    bool good_;
+};
+
+/*
+ * deserialize object from [data, data + size) within limits: the end of
+ * object, or nullptr if the input is truncated or exceeds the limits
+ *
+ * on failure object is left partially decoded, within the limits
+ *
+ */
+template <typename TO>
+inline const char* deserialize_limited(const char* data, size_t size, TO& object,
+        const RawDecodeLimits& limits)
+{
+    RawMemoryReader memory(data, size);
+    RawLimitedReader<RawMemoryReader> reader(memory, limits);
+
+    deserialize(make_stream_buffer(reader), object);
+
+    return reader.good() ? memory.head() : nullptr;
+}
+
+} // namespace NAMESPACE
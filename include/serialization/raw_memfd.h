@@ -0,0 +1,310 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+large message passing over unix domain sockets with sealed memfd
+
+*/
+
+#pragma once
+
+#include <cerrno>  // for errno
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <cstring> // for memcpy, memset
+
+#include <fcntl.h>      // for fcntl, F_ADD_SEALS, F_GET_SEALS
+#include <sys/mman.h>   // for memfd_create, mmap
+#include <sys/socket.h> // for sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/stat.h>   // for fstat
+#include <sys/uio.h>    // for iovec
+#include <unistd.h>     // for close, ftruncate
+
+#include "raw.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * read-only mapping of a received memfd
+ *
+ * deserialize from data() or read zero-copy views straight out of it,
+ * the seals guarantee the sender can no longer change or shrink it
+ *
+ */
+class RawMemfdMapping
+{
+public:
+    RawMemfdMapping():
+        fd_(-1), data_(nullptr), size_(0)
+    {
+    }
+
+    RawMemfdMapping(RawMemfdMapping&& other):
+        fd_(other.fd_), data_(other.data_), size_(other.size_)
+    {
+        other.fd_ = -1;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    RawMemfdMapping& operator=(RawMemfdMapping&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            fd_ = other.fd_;
+            data_ = other.data_;
+            size_ = other.size_;
+            other.fd_ = -1;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+
+        return *this;
+    }
+
+    RawMemfdMapping(const RawMemfdMapping&) = delete;
+    RawMemfdMapping& operator=(const RawMemfdMapping&) = delete;
+
+    ~RawMemfdMapping()
+    {
+        reset();
+    }
+
+    inline const char* data() const
+    {
+        return data_;
+    }
+
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    inline explicit operator bool() const
+    {
+        return fd_ >= 0;
+    }
+
+    // map a sealed memfd of size bytes, takes the ownership of fd
+    inline bool map(int fd, size_t size)
+    {
+        const int seals = F_SEAL_SHRINK | F_SEAL_WRITE;
+        struct stat st;
+
+        reset();
+        fd_ = fd;
+
+        // not a memfd, or no seals at all
+        const int result = fcntl(fd, F_GET_SEALS);
+
+        if (result < 0)
+        {
+            return false;
+        }
+        if ((result & seals) != seals)
+        {
+            errno = EPERM;
+            return false;
+        }
+
+        if (fstat(fd, &st) < 0)
+        {
+            return false;
+        }
+
+        if (size_t(st.st_size) < size)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        if (size > 0)
+        {
+            const auto address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (address == MAP_FAILED)
+            {
+                return false;
+            }
+
+            data_ = static_cast<const char*>(address);
+            size_ = size;
+        }
+
+        return true;
+    }
+
+    inline void reset()
+    {
+        if (data_ != nullptr)
+        {
+            munmap(const_cast<char*>(data_), size_);
+        }
+
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+
+        fd_ = -1;
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    int fd_;
+    const char* data_;
+    size_t size_;
+};
+
+/*
+ * serialize object into a fresh memfd, seal it and pass it over socket
+ * 0 on success, -1 with errno set on failure
+ *
+ * the serialization is the only write to the payload, the memfd is unmapped
+ * before sealing so that F_SEAL_WRITE can be applied
+ *
+ */
+template <typename TO>
+inline int send_memfd(int socket, const TO& object)
+{
+    const size_t size = serialized_size(object);
+    const int fd = memfd_create("raw_memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int result = -1;
+
+    do
+    {
+        if (ftruncate(fd, off_t(size)) < 0)
+        {
+            break;
+        }
+
+        if (size > 0)
+        {
+            const auto address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+
+            if (address == MAP_FAILED)
+            {
+                break;
+            }
+
+            serialize(static_cast<char*>(address), object);
+            munmap(address, size);
+        }
+
+        if (fcntl(fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+        {
+            break;
+        }
+
+        uint64_t length = size;
+        struct iovec vector = { &length, sizeof(length) };
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr message;
+
+        memset(control, 0, sizeof(control));
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const auto header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+        ssize_t count;
+        do
+        {
+            count = sendmsg(socket, &message, MSG_NOSIGNAL);
+        }
+        while (count < 0 && errno == EINTR);
+
+        result = count == ssize_t(sizeof(length)) ? 0 : -1;
+    }
+    while (false);
+
+    const int error = errno;
+    close(fd);
+    errno = error;
+
+    return result;
+}
+
+/*
+ * receive a memfd passed by send_memfd() and map it
+ * 0 on success, -1 with errno set on failure
+ *
+ */
+inline int recv_memfd(int socket, RawMemfdMapping& mapping)
+{
+    uint64_t length = 0;
+    struct iovec vector = { &length, sizeof(length) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+
+    memset(control, 0, sizeof(control));
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    do
+    {
+        count = recvmsg(socket, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    }
+    while (count < 0 && errno == EINTR);
+
+    const auto header = CMSG_FIRSTHDR(&message);
+    int fd = -1;
+
+    if (header != nullptr && header->cmsg_level == SOL_SOCKET &&
+            header->cmsg_type == SCM_RIGHTS)
+    {
+        memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    }
+
+    if (count != ssize_t(sizeof(length)) || fd < 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        errno = count < 0 ? errno : EPROTO;
+        return -1;
+    }
+
+    return mapping.map(fd, size_t(length)) ? 0 : -1;
+}
+
+// receive a memfd passed by send_memfd() and deserialize from the mapping
+template <typename TO>
+inline int recv_memfd(int socket, TO& object)
+{
+    RawMemfdMapping mapping;
+
+    if (recv_memfd(socket, mapping) < 0)
+    {
+        return -1;
+    }
+
+    deserialize(mapping.data(), object);
+    return 0;
+}
+
+} // namespace NAMESPACE
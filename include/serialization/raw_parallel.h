@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+fork-join helpers of the stores
+
+*/
+
+#pragma once
+
+#include <algorithm> // for std::sort, std::inplace_merge
+#include <cstddef>   // for size_t
+#include <thread>    // for std::thread
+#include <vector>
+
+namespace NAMESPACE
+{
+
+/*
+ * call(idx) for idx in [0, count), interleaved over up to thread_count
+ * threads, the calling one included, and wait for them all
+ *
+ */
+template <typename TF>
+inline void parallel_for(size_t count, size_t thread_count, const TF& call)
+{
+    thread_count = count < thread_count ? count : thread_count;
+
+    std::vector<std::thread> threads;
+
+    auto run = [&](size_t first)
+    {
+        for (size_t idx = first; idx < count; idx += thread_count)
+        {
+            call(idx);
+        }
+    };
+
+    for (size_t first = 1; first < thread_count; ++first)
+    {
+        threads.emplace_back(run, first);
+    }
+    if (thread_count > 0)
+    {
+        run(0);
+    }
+
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+}
+
+/*
+ * sort [first, last) by less with up to thread_count threads: as many
+ * runs sorted in parallel, then merged pairwise in parallel
+ *
+ */
+template <typename TIt, typename TF>
+inline void parallel_sort(TIt first, TIt last, const TF& less, size_t thread_count)
+{
+    const size_t count = size_t(last - first);
+    const size_t run_count = thread_count < 1 ? 1 : count < thread_count ? count : thread_count;
+
+    if (run_count <= 1)
+    {
+        std::sort(first, last, less);
+        return;
+    }
+
+    std::vector<size_t> bounds(run_count + 1);
+
+    for (size_t idx = 0; idx <= run_count; ++idx)
+    {
+        bounds[idx] = count * idx / run_count;
+    }
+
+    parallel_for(run_count, thread_count, [&](size_t idx)
+    {
+        std::sort(first + bounds[idx], first + bounds[idx + 1], less);
+    });
+
+    for (size_t width = 1; width < run_count; width *= 2)
+    {
+        parallel_for((run_count + 2 * width - 1) / (2 * width), thread_count, [&](size_t idx)
+        {
+            const size_t low = 2 * width * idx;
+            const size_t middle = low + width < run_count ? low + width : run_count;
+            const size_t high = low + 2 * width < run_count ? low + 2 * width : run_count;
+
+            std::inplace_merge(first + bounds[low], first + bounds[middle],
+                    first + bounds[high], less);
+        });
+    }
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,220 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+pipelined serialization: the caller serializes into one buffer while an
+I/O thread drains the others
+
+*/
+
+#pragma once
+
+#include <atomic>             // for std::atomic
+#include <condition_variable> // for std::condition_variable
+#include <cstddef>            // for size_t
+#include <cstring>            // for memcpy
+#include <memory>             // for std::unique_ptr
+#include <mutex>              // for std::mutex, std::unique_lock, std::lock_guard
+#include <thread>             // for std::thread, std::this_thread::yield
+#include <utility>            // for std::pair, std::move
+#include <vector>
+
+#include "raw_ring.h"
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * pipelined writer: stream policy filling buffer_count buffers of
+ * buffer_size bytes in turn, each full one is passed to the sink on an
+ * I/O thread of its own
+ *
+ *      void sink(const char* data, size_t size)    // on the I/O thread
+ *
+ * the buffers are handed over through two RawSpscRing, the side without
+ * a buffer to work on spins briefly, then sleeps until one comes back
+ *
+ */
+template <typename TF>
+class RawPipelinedWriter
+{
+public:
+    RawPipelinedWriter(size_t buffer_size, size_t buffer_count, TF sink):
+        buffer_size_(buffer_size),
+        storage_(new char[buffer_size * (buffer_count < 2 ? 2 : buffer_count)]),
+        buffers_(buffer_count < 2 ? 2 : buffer_count),
+        sink_(std::move(sink)),
+        full_(ring_capacity * buffers_.size()), idle_(ring_capacity * buffers_.size()),
+        drained_(0), current_(0), fill_(0), handed_(0), size_(0)
+    {
+        for (size_t idx = 0; idx < buffers_.size(); ++idx)
+        {
+            buffers_[idx] = storage_.get() + buffer_size_ * idx;
+            if (idx > 0)
+            {
+                idle_.push(idx);
+            }
+        }
+
+        thread_ = std::thread(&RawPipelinedWriter::run, this);
+    }
+
+    RawPipelinedWriter(const RawPipelinedWriter&) = delete;
+    RawPipelinedWriter& operator=(const RawPipelinedWriter&) = delete;
+
+    ~RawPipelinedWriter()
+    {
+        const size_t mark = stop_mark;
+
+        flush();
+        wait([&]() { return full_.push(Handover(mark, 0)); });
+        notify();
+        thread_.join();
+    }
+
+    inline void write(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+
+        size_ += size;
+        while (size > 0)
+        {
+            const size_t count = size < buffer_size_ - fill_ ? size : buffer_size_ - fill_;
+
+            memcpy(buffers_[current_] + fill_, bytes, count);
+            fill_ += count;
+            bytes += count;
+            size -= count;
+
+            if (fill_ == buffer_size_)
+            {
+                hand_over();
+            }
+        }
+    }
+
+    // pass the last partial buffer, and wait for the sink to drain all
+    inline void flush()
+    {
+        if (fill_ > 0)
+        {
+            hand_over();
+        }
+
+        wait([&]() { return drained_.load(std::memory_order_acquire) >= handed_; });
+    }
+
+    // bytes written so far
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    using Handover = std::pair<size_t, size_t>; // index, size
+
+    static const size_t stop_mark = ~size_t(0);
+    static const size_t ring_capacity = 64; // bytes of ring per buffer
+    static const size_t spin_count = 64;    // yields before sleeping
+
+    // pass the current buffer to the I/O thread, and wait for an idle one
+    inline void hand_over()
+    {
+        wait([&]() { return full_.push(Handover(current_, fill_)); });
+        notify();
+        ++handed_;
+        fill_ = 0;
+
+        wait([&]() { return idle_.pop(current_); });
+        notify();
+    }
+
+    // spin briefly until ready() holds, then sleep until it does
+    template <typename TP>
+    inline void wait(const TP& ready)
+    {
+        for (size_t spin = 0; spin < spin_count; ++spin)
+        {
+            if (ready())
+            {
+                return;
+            }
+
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        wake_.wait(lock, ready);
+    }
+
+    // wake the other side after a change of the rings or drained_
+    inline void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_); // not between its test and its sleep
+        }
+
+        wake_.notify_all();
+    }
+
+    // the I/O thread
+    inline void run()
+    {
+        Handover handover;
+
+        for (;;)
+        {
+            wait([&]() { return full_.pop(handover); });
+            notify();
+
+            if (handover.first == stop_mark)
+            {
+                break;
+            }
+
+            sink_(buffers_[handover.first], handover.second);
+            drained_.fetch_add(1, std::memory_order_release);
+            wait([&]() { return idle_.push(handover.first); });
+            notify();
+        }
+    }
+
+    const size_t buffer_size_;
+    const std::unique_ptr<char[]> storage_;
+    std::vector<char*> buffers_;
+    TF sink_;
+
+    RawSpscRing full_; // caller -> I/O thread
+    RawSpscRing idle_; // I/O thread -> caller
+    std::thread thread_;
+    std::atomic<size_t> drained_; // buffers passed to the sink
+    std::mutex mutex_;            // for the sleeps of wait()
+    std::condition_variable wake_;
+
+    // caller side
+    size_t current_;
+    size_t fill_;
+    size_t handed_; // buffers handed over
+    size_t size_;
+};
+
+/*
+ * serialize object to sink through a RawPipelinedWriter, the serialized size
+ * the sink is called on another thread, with buffer_size bytes but the last
+ *
+ */
+template <typename TO, typename TF>
+inline size_t serialize_pipelined(const TO& object, size_t buffer_size, size_t buffer_count,
+        TF sink)
+{
+    RawPipelinedWriter<TF> writer(buffer_size, buffer_count, std::move(sink));
+
+    serialize(make_stream_buffer(writer), object);
+    writer.flush();
+
+    return writer.size();
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,352 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+pooled serialization buffers: thread-local free lists in size classes,
+allocated once by a per-type estimate of the serialized size
+
+*/
+
+#pragma once
+
+#include <cstddef> // for size_t
+#include <cstring> // for memcpy
+#include <memory>  // for std::unique_ptr
+#include <utility> // for std::swap
+#include <vector>
+
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * buffer from the pool of the current thread, given back to the pool of
+ * the thread destroying it, or freed if that thread has none, or no longer
+ * has one at its exit
+ *
+ */
+class RawPooledBuffer
+{
+public:
+    RawPooledBuffer():
+        data_(nullptr), capacity_(0), size_(0)
+    {
+    }
+
+    RawPooledBuffer(char* data, size_t capacity):
+        data_(data), capacity_(capacity), size_(0)
+    {
+    }
+
+    RawPooledBuffer(RawPooledBuffer&& other):
+        RawPooledBuffer()
+    {
+        swap(other);
+    }
+
+    RawPooledBuffer& operator=(RawPooledBuffer&& other)
+    {
+        RawPooledBuffer(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    RawPooledBuffer(const RawPooledBuffer&) = delete;
+    RawPooledBuffer& operator=(const RawPooledBuffer&) = delete;
+
+    inline ~RawPooledBuffer();
+
+    inline void swap(RawPooledBuffer& other)
+    {
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+    }
+
+    inline char* data() const
+    {
+        return data_;
+    }
+
+    inline size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // bytes in use, set by the user
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    inline void resize(size_t size)
+    {
+        size_ = size;
+    }
+
+private:
+    char* data_;
+    size_t capacity_;
+    size_t size_;
+};
+
+/*
+ * thread-local pool of buffers in power of 2 size classes
+ *
+ * buffers above the largest class are allocated exactly and freed on
+ * release, every class keeps at most max_idle buffers
+ *
+ */
+class RawBufferPool
+{
+public:
+    static const size_t min_class = 8;  // 256 bytes
+    static const size_t max_class = 26; // 64M bytes
+    static const size_t max_idle = 8;
+
+    RawBufferPool(const RawBufferPool&) = delete;
+    RawBufferPool& operator=(const RawBufferPool&) = delete;
+
+    // the pool of the current thread
+    static inline RawBufferPool& local()
+    {
+        static thread_local RawBufferPool pool;
+
+        return pool;
+    }
+
+    // the pool of the current thread if alive, without creating it
+    static inline RawBufferPool* current()
+    {
+        return current_pointer();
+    }
+
+    // a buffer of at least size bytes
+    inline RawPooledBuffer acquire(size_t size)
+    {
+        const size_t index = class_of(size);
+
+        if (index > max_class)
+        {
+            return RawPooledBuffer(new char[size], size);
+        }
+
+        auto& idle = idle_[index - min_class];
+        const size_t capacity = size_t(1) << index;
+
+        if (idle.empty())
+        {
+            return RawPooledBuffer(new char[capacity], capacity);
+        }
+
+        char* const data = idle.back().release();
+
+        idle.pop_back();
+        return RawPooledBuffer(data, capacity);
+    }
+
+    inline void release(char* data, size_t capacity)
+    {
+        const size_t index = class_of(capacity);
+
+        if (index > max_class || capacity != size_t(1) << index ||
+                idle_[index - min_class].size() >= max_idle)
+        {
+            delete[] data;
+            return;
+        }
+
+        idle_[index - min_class].emplace_back(data);
+    }
+
+    // buffers kept for reuse
+    inline size_t idle() const
+    {
+        size_t count = 0;
+
+        for (const auto& idle: idle_)
+        {
+            count += idle.size();
+        }
+
+        return count;
+    }
+
+private:
+    RawBufferPool()
+    {
+        current_pointer() = this;
+    }
+
+    ~RawBufferPool()
+    {
+        current_pointer() = nullptr;
+    }
+
+    // trivially destructible, so valid through the whole thread exit
+    static inline RawBufferPool*& current_pointer()
+    {
+        static thread_local RawBufferPool* pointer = nullptr;
+
+        return pointer;
+    }
+
+    static inline size_t class_of(size_t size)
+    {
+        size_t index = min_class;
+
+        while (index <= max_class && size > size_t(1) << index)
+        {
+            ++index;
+        }
+
+        return index;
+    }
+
+    std::vector<std::unique_ptr<char[]>> idle_[max_class - min_class + 1];
+};
+
+inline RawPooledBuffer::~RawPooledBuffer()
+{
+    if (data_ == nullptr)
+    {
+        return;
+    }
+
+    const auto pool = RawBufferPool::current();
+
+    if (pool != nullptr)
+    {
+        pool->release(data_, capacity_);
+    }
+    else
+    {
+        delete[] data_;
+    }
+}
+
+/*
+ * per-type running estimate of the serialized size, thread-local
+ *
+ * rises at once to any larger size with some headroom, decays slowly
+ * towards smaller ones
+ *
+ */
+template <typename TO>
+struct RawSizeEstimate
+{
+    static inline size_t& local()
+    {
+        static thread_local size_t estimate = 0;
+
+        return estimate;
+    }
+
+    static inline size_t get()
+    {
+        return local();
+    }
+
+    static inline void update(size_t size)
+    {
+        auto& estimate = local();
+
+        if (size > estimate)
+        {
+            estimate = size + size / 8;
+        }
+        else
+        {
+            estimate -= (estimate - size) / 16;
+        }
+    }
+};
+
+/*
+ * bounded writer: stream policy writing into [data, data + capacity)
+ * the bytes beyond are dropped but counted, making it overflow()
+ *
+ * the small writes, i.e. short strings, are copied inline, as a memcpy()
+ * call costs more than a few bytes
+ *
+ */
+class RawBoundedWriter
+{
+public:
+    static const size_t inline_size = 16;
+
+    RawBoundedWriter(char* data, size_t capacity):
+        data_(data), capacity_(capacity), size_(0)
+    {
+    }
+
+    inline void write(const void* data, size_t size)
+    {
+        if (size_ <= capacity_ && size <= capacity_ - size_)
+        {
+            char* const head = data_ + size_;
+
+            if (size <= inline_size)
+            {
+                auto bytes = static_cast<const char*>(data);
+
+                for (size_t idx = 0; idx < size; ++idx)
+                {
+                    head[idx] = bytes[idx];
+                }
+            }
+            else
+            {
+                memcpy(head, data, size);
+            }
+        }
+        size_ += size;
+    }
+
+    // bytes written so far, including the dropped
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    inline bool overflow() const
+    {
+        return size_ > capacity_;
+    }
+
+private:
+    char* const data_;
+    const size_t capacity_;
+    size_t size_;
+};
+
+/*
+ * serialize object into a pooled buffer sized by RawSizeEstimate<TO>, in
+ * one pass through RawBoundedWriter; only when the estimate falls short,
+ * the pass having counted the size anyway, a buffer of that size is taken
+ * and serialized into again through the char* serializer
+ *
+ */
+template <typename TO>
+inline RawPooledBuffer serialize_pooled(const TO& object)
+{
+    auto& pool = RawBufferPool::local();
+    auto buffer = pool.acquire(RawSizeEstimate<TO>::get());
+    RawBoundedWriter writer(buffer.data(), buffer.capacity());
+
+    serialize(make_stream_buffer(writer), object);
+
+    const size_t size = writer.size();
+
+    if (writer.overflow())
+    {
+        buffer = pool.acquire(size);
+        serialize(buffer.data(), object);
+    }
+    buffer.resize(size);
+    RawSizeEstimate<TO>::update(size);
+
+    return buffer;
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,909 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+durable append-only log of serialized records: segment files, length and
+CRC32C framing, a sparse index by sequence number, batched fsync, and
+background compaction keeping the latest record of each key
+
+*/
+
+#pragma once
+
+#include <algorithm>     // for std::sort, std::upper_bound
+#include <atomic>        // for std::atomic
+#include <cerrno>        // for errno
+#include <chrono>        // for std::chrono::steady_clock
+#include <cstddef>       // for size_t
+#include <cstdint>       // for uint32_t, uint64_t, UINT32_MAX
+#include <cstdio>        // for snprintf
+#include <cstdlib>       // for strtoull
+#include <cstring>       // for memcpy
+#include <functional>    // for std::hash
+#include <map>
+#include <memory>        // for std::shared_ptr
+#include <mutex>         // for std::mutex, std::lock_guard
+#include <string>
+#include <thread>        // for std::thread
+#include <tuple>
+#include <unordered_map>
+#include <utility>       // for std::pair
+#include <vector>
+
+#include <dirent.h>    // for opendir, readdir, closedir
+#include <fcntl.h>     // for open, O_*
+#include <sys/stat.h>  // for fstat
+#include <sys/types.h> // for off_t, ssize_t
+#include <unistd.h>    // for pread, pwrite, fdatasync, ftruncate, close, unlink
+
+#include "raw_checksum.h"
+#include "raw_file.h"
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * record layout:
+ *
+ *      | uint32_t size | uint32_t crc | uint64_t sequence | key | value |
+ *
+ * size counts the serialized key and value, crc is the CRC32C of the
+ * sequence and them
+ *
+ */
+struct RawRecordHeader
+{
+    uint32_t size;
+    uint32_t crc;
+    uint64_t sequence;
+};
+
+/*
+ * segment "<first>.log" of a record log, with its sparse index of (sequence,
+ * offset), an entry every index_interval bytes, kept in "<first>.index" once
+ * the segment is sealed
+ *
+ */
+struct RawLogSegment
+{
+    using Index = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    RawLogSegment(uint64_t first, int fd):
+        first(first), last(first - 1), size(0), fd(fd)
+    {
+    }
+
+    RawLogSegment(const RawLogSegment&) = delete;
+    RawLogSegment& operator=(const RawLogSegment&) = delete;
+
+    ~RawLogSegment()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    // note the record of sequence at offset
+    inline void track(uint64_t sequence, uint64_t offset, size_t index_interval)
+    {
+        if (index.empty() || offset >= index.back().second + index_interval)
+        {
+            index.emplace_back(sequence, offset);
+        }
+
+        last = sequence;
+    }
+
+    // the offset to scan from for the record of sequence
+    inline uint64_t seek(uint64_t sequence) const
+    {
+        const auto entry = std::upper_bound(index.begin(), index.end(),
+                std::make_pair(sequence, ~uint64_t(0)));
+
+        return entry == index.begin() ? 0 : (entry - 1)->second;
+    }
+
+    const uint64_t first;   // the sequence in the name
+    uint64_t last;          // the last sequence, first - 1 if empty
+    uint64_t size;          // bytes of records in the file
+    int fd;
+    Index index;
+};
+
+/*
+ * check the record at data, of rest bytes at most: true, and its header, if
+ * it is whole, intact and after sequence after
+ *
+ */
+inline bool check_record(const char* data, uint64_t rest, uint64_t after, RawRecordHeader& header)
+{
+    if (rest < sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    return header.sequence > after && header.size <= rest - sizeof(header) &&
+            crc32c(data + sizeof(header) - sizeof(header.sequence),
+                    sizeof(header.sequence) + header.size) == header.crc;
+}
+
+/*
+ * visit(header, payload, offset) the records of fd in [offset, size) in
+ * order, until visit returns false or a record is torn, corrupt or not
+ * after the previous one, the first after sequence after
+ * end is set past the last record visited
+ * 0, or -1 with errno set on a read error
+ *
+ */
+template <typename TF>
+inline int scan_records(int fd, uint64_t offset, uint64_t size, uint64_t after,
+        const TF& visit, uint64_t& end)
+{
+    const size_t block_size = 1 << 20;
+    std::vector<char> buf;
+    uint64_t buf_offset = offset; // buf holds [buf_offset, buf_end)
+    uint64_t buf_end = offset;
+    int error = 0;
+
+    // make [offset, offset + count) available in buf
+    auto load = [&](uint64_t count) -> bool
+    {
+        if (offset + count <= buf_end)
+        {
+            return true;
+        }
+
+        const uint64_t rest = size - offset;
+
+        if (count > rest)
+        {
+            return false;
+        }
+
+        const size_t length = size_t(count > block_size ? count : rest < block_size ? rest : block_size);
+
+        buf.resize(length);
+        for (size_t done = 0; done < length; )
+        {
+            const ssize_t result = pread(fd, buf.data() + done, length - done, off_t(offset + done));
+
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                error = result < 0 ? errno : 0;
+                return false;
+            }
+
+            done += size_t(result);
+        }
+
+        buf_offset = offset;
+        buf_end = offset + length;
+        return true;
+    };
+
+    while (offset < size && load(sizeof(RawRecordHeader)))
+    {
+        RawRecordHeader header;
+
+        memcpy(&header, buf.data() + (offset - buf_offset), sizeof(header));
+
+        const uint64_t total = sizeof(header) + uint64_t(header.size);
+
+        if (total > size - offset || !load(total))
+        {
+            break;
+        }
+
+        const char* const record = buf.data() + (offset - buf_offset);
+
+        if (!check_record(record, total, after, header))
+        {
+            break;
+        }
+
+        const bool more = visit(header, record + sizeof(header), offset);
+
+        after = header.sequence;
+        offset += total;
+        if (!more)
+        {
+            break;
+        }
+    }
+
+    end = offset;
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * record log of (TK key, TV value) in directory, sequence numbers from 1
+ *
+ * appended records are batched in memory and synced once sync_size bytes
+ * are pending or the oldest one is older than sync_delay, event loops
+ * should call poll() when idle to honor the deadline; a segment is sealed
+ * past segment_size bytes and a new one started
+ *
+ * compaction rewrites each sealed segment with the records still the latest
+ * of their key among the sealed segments, by replacing the file atomically,
+ * so records of older sequences may vanish; it runs on a thread of its own
+ * while the owner thread goes on appending and reading
+ *
+ */
+template <typename TK, typename TV, typename TH = std::hash<TK>>
+class RawRecordLog
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit RawRecordLog(std::string directory,
+            size_t segment_size = 64 << 20,
+            size_t sync_size = 1 << 20,
+            clock::duration sync_delay = std::chrono::milliseconds(1),
+            size_t index_interval = 4 << 10):
+        directory_(std::move(directory)), segment_size_(segment_size),
+        sync_size_(sync_size), sync_delay_(sync_delay), index_interval_(index_interval),
+        next_(1), unsynced_(false), sync_error_(0), compacting_(false), compaction_error_(0)
+    {
+        pending_.reserve(sync_size_);
+    }
+
+    RawRecordLog(const RawRecordLog&) = delete;
+    RawRecordLog& operator=(const RawRecordLog&) = delete;
+
+    ~RawRecordLog()
+    {
+        wait_compaction();
+        if (active_)
+        {
+            sync();
+        }
+    }
+
+    /*
+     * open the segments in directory, starting the first one if none, and
+     * cut a torn tail off the last one
+     * 0, or -1 with errno set, EBADMSG for a corrupt sealed segment
+     *
+     */
+    inline int open()
+    {
+        DIR* const dir = opendir(directory_.c_str());
+        std::vector<uint64_t> firsts;
+
+        if (dir == nullptr)
+        {
+            return -1;
+        }
+
+        for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            {
+                unlink((directory_ + "/" + name).c_str()); // an interrupted rewrite
+            }
+            else if (name.size() == 24 && name.compare(20, 4, ".log") == 0)
+            {
+                firsts.push_back(strtoull(name.c_str(), nullptr, 10));
+            }
+        }
+        closedir(dir);
+
+        std::sort(firsts.begin(), firsts.end());
+        for (size_t idx = 0; idx < firsts.size(); ++idx)
+        {
+            std::shared_ptr<RawLogSegment> segment;
+
+            if (open_segment(firsts[idx], idx + 1 == firsts.size(), segment) < 0)
+            {
+                return -1;
+            }
+
+            segments_[firsts[idx]] = segment;
+        }
+
+        if (segments_.empty())
+        {
+            return create_segment(next_);
+        }
+
+        active_ = segments_.rbegin()->second;
+        next_ = active_->last + 1;
+        return 0;
+    }
+
+    // the sequence number of the next record
+    inline uint64_t next_sequence() const
+    {
+        return next_;
+    }
+
+    /*
+     * append a record, its sequence number, or 0 with errno set if it was
+     * not appended
+     *
+     * the record is appended once queued: a sync failing on the way leaves
+     * it pending, to be written by the next sync, which reports the error
+     *
+     */
+    inline uint64_t append(const TK& key, const TV& value)
+    {
+        const size_t size = serialized_size(key) + serialized_size(value);
+        const size_t total = sizeof(RawRecordHeader) + size;
+        const uint64_t sequence = next_;
+
+        if (size > UINT32_MAX)
+        {
+            errno = EMSGSIZE;
+            return 0;
+        }
+
+        const uint64_t used = active_->size + pending_.size();
+
+        if (used > 0 && used + total > segment_size_ && roll() < 0)
+        {
+            return 0;
+        }
+
+        const size_t offset = pending_.size();
+        RawRecordHeader header = { uint32_t(size), 0, sequence };
+        RawCrc32c checksum;
+
+        // the payload is checksummed as it is serialized
+        pending_.resize(offset + total);
+        checksum.update(&header.sequence, sizeof(header.sequence));
+        {
+            RawBoundedWriter writer(&pending_[offset + sizeof(header)], size);
+            RawChecksumWriter<RawBoundedWriter, RawCrc32c> fused(writer, checksum);
+            auto buffer = make_stream_buffer(fused);
+
+            serialize(buffer, key);
+            serialize(buffer, value);
+            fused.flush();
+        }
+
+        header.crc = checksum.value();
+        memcpy(&pending_[offset], &header, sizeof(header));
+
+        active_->track(sequence, active_->size + offset, index_interval_);
+        if (offset == 0)
+        {
+            deadline_ = clock::now() + sync_delay_;
+        }
+        ++next_;
+
+        if (pending_.size() >= sync_size_ ? sync() < 0 : poll() < 0)
+        {
+            sync_error_ = errno;
+        }
+
+        return sequence;
+    }
+
+    // sync if the oldest pending record is due, 0, or -1 with errno set
+    inline int poll()
+    {
+        return !pending_.empty() && clock::now() >= deadline_ ? sync() : 0;
+    }
+
+    /*
+     * make the appended records durable, 0, or -1 with errno set, also for
+     * a sync failed in append() since the last call
+     *
+     */
+    inline int sync()
+    {
+        const int error = sync_error_;
+
+        sync_error_ = 0;
+        if (write_pending() < 0)
+        {
+            return -1;
+        }
+        if (unsynced_ && fdatasync(active_->fd) < 0)
+        {
+            return -1;
+        }
+
+        unsynced_ = false;
+        if (error != 0)
+        {
+            errno = error;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    // the record of sequence, 0, or -1 with errno set, ENOENT if absent or compacted
+    inline int read(uint64_t sequence, TK& key, TV& value)
+    {
+        if (write_pending() < 0)
+        {
+            return -1;
+        }
+
+        const auto segment = find(sequence);
+
+        if (!segment || sequence > segment->last)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+
+        bool found = false;
+        uint64_t end;
+
+        auto visit = [&](const RawRecordHeader& header, const char* payload, uint64_t)
+        {
+            if (header.sequence == sequence)
+            {
+                deserialize(deserialize(payload, key), value);
+                found = true;
+            }
+
+            return header.sequence < sequence;
+        };
+
+        if (scan_records(segment->fd, segment->seek(sequence), segment->size,
+                segment->first - 1, visit, end) < 0)
+        {
+            return -1;
+        }
+        if (!found)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /*
+     * visit(sequence, key, value) the records from sequence on, in order
+     * 0, or -1 with errno set, EBADMSG for a corrupt segment
+     *
+     */
+    template <typename TF>
+    inline int replay(uint64_t sequence, TF visit)
+    {
+        if (write_pending() < 0)
+        {
+            return -1;
+        }
+
+        TK key;
+        TV value;
+
+        auto call = [&](const RawRecordHeader& header, const char* payload, uint64_t)
+        {
+            if (header.sequence >= sequence)
+            {
+                deserialize(deserialize(payload, key), value);
+                visit(header.sequence, key, value);
+            }
+
+            return true;
+        };
+
+        for (const auto& segment: segments_from(sequence))
+        {
+            uint64_t end;
+
+            if (scan_records(segment->fd, segment->seek(sequence), segment->size,
+                    segment->first - 1, call, end) < 0)
+            {
+                return -1;
+            }
+            if (end != segment->size)
+            {
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    // start compacting the sealed segments, 0, or -1 with errno set, EBUSY if compacting
+    inline int start_compaction()
+    {
+        if (compacting_)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        if (compactor_.joinable())
+        {
+            compactor_.join();
+        }
+
+        compacting_ = true;
+        compactor_ = std::thread([this]()
+        {
+            compaction_error_ = compact();
+            compacting_ = false;
+        });
+
+        return 0;
+    }
+
+    inline bool compacting() const
+    {
+        return compacting_;
+    }
+
+    // wait for the compaction, 0 or -1 with errno set to its failure
+    inline int wait_compaction()
+    {
+        if (compactor_.joinable())
+        {
+            compactor_.join();
+        }
+
+        errno = compaction_error_;
+        return compaction_error_ == 0 ? 0 : -1;
+    }
+
+    inline size_t segment_count() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return segments_.size();
+    }
+
+    // bytes of records, in the segments and pending
+    inline uint64_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t result = pending_.size();
+
+        for (const auto& entry: segments_)
+        {
+            result += entry.second->size;
+        }
+
+        return result;
+    }
+
+    // the segments holding sequence and after, for readers of their files after sync()
+    inline std::vector<std::shared_ptr<RawLogSegment>> segments_from(uint64_t sequence) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::shared_ptr<RawLogSegment>> result;
+
+        for (const auto& entry: segments_)
+        {
+            if (entry.second->last >= sequence)
+            {
+                result.push_back(entry.second);
+            }
+        }
+
+        return result;
+    }
+
+private:
+    using IndexFile = std::tuple<uint64_t, uint64_t, RawLogSegment::Index>; // size, last, index
+
+    inline std::string path_of(uint64_t first, const char* suffix) const
+    {
+        char name[32];
+
+        snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(first), suffix);
+        return directory_ + "/" + name;
+    }
+
+    inline std::shared_ptr<RawLogSegment> find(uint64_t sequence) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto entry = segments_.upper_bound(sequence);
+
+        return entry == segments_.begin() ? nullptr : std::prev(entry)->second;
+    }
+
+    inline int open_segment(uint64_t first, bool active, std::shared_ptr<RawLogSegment>& result)
+    {
+        const int fd = ::open(path_of(first, ".log").c_str(), O_RDWR | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        auto segment = std::make_shared<RawLogSegment>(first, fd);
+        struct stat info;
+
+        if (fstat(fd, &info) < 0)
+        {
+            return -1;
+        }
+
+        const uint64_t size = uint64_t(info.st_size);
+
+        if (!active && read_index(*segment, size) == 0)
+        {
+            result = std::move(segment);
+            return 0;
+        }
+
+        uint64_t end;
+
+        auto visit = [&](const RawRecordHeader& header, const char*, uint64_t offset)
+        {
+            segment->track(header.sequence, offset, index_interval_);
+            return true;
+        };
+
+        if (scan_records(fd, 0, size, first - 1, visit, end) < 0)
+        {
+            return -1;
+        }
+
+        segment->size = end;
+        if (end < size && !active)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+        if (end < size && ftruncate(fd, off_t(end)) < 0)
+        {
+            return -1;
+        }
+        if (!active && write_index(*segment) < 0)
+        {
+            return -1;
+        }
+
+        result = std::move(segment);
+        return 0;
+    }
+
+    inline int create_segment(uint64_t first)
+    {
+        const int fd = ::open(path_of(first, ".log").c_str(),
+                O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        auto segment = std::make_shared<RawLogSegment>(first, fd);
+
+        if (sync_directory(directory_) < 0)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        segments_[first] = segment;
+        active_ = std::move(segment);
+        return 0;
+    }
+
+    // seal the active segment, start the next one
+    inline int roll()
+    {
+        if (sync() < 0 || write_index(*active_) < 0)
+        {
+            return -1;
+        }
+
+        return create_segment(next_);
+    }
+
+    inline int write_index(const RawLogSegment& segment) const
+    {
+        const IndexFile file(segment.size, segment.last, segment.index);
+        std::vector<char> buf(serialized_size(file));
+
+        serialize(buf.data(), file);
+        return write_file_atomic(path_of(segment.first, ".index"), buf.data(), buf.size());
+    }
+
+    // the index of segment from its file, if it describes size bytes
+    inline int read_index(RawLogSegment& segment, uint64_t size) const
+    {
+        std::vector<char> buf;
+        IndexFile file;
+
+        if (read_file(path_of(segment.first, ".index"), buf) < 0)
+        {
+            return -1;
+        }
+
+        const char* const end = buf.data() + buf.size();
+
+        if (validate<IndexFile>(static_cast<const char*>(buf.data()), end) != end)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        deserialize(static_cast<const char*>(buf.data()), file);
+        if (std::get<0>(file) != size)
+        {
+            errno = ESTALE;
+            return -1;
+        }
+
+        segment.size = std::get<0>(file);
+        segment.last = std::get<1>(file);
+        segment.index = std::move(std::get<2>(file));
+        return 0;
+    }
+
+    // write the pending records to the active segment
+    inline int write_pending()
+    {
+        size_t done = 0;
+
+        unsynced_ = unsynced_ || !pending_.empty();
+        while (done < pending_.size())
+        {
+            const ssize_t count = pwrite(active_->fd, pending_.data() + done,
+                    pending_.size() - done, off_t(active_->size));
+
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count < 0)
+            {
+                pending_.erase(pending_.begin(), pending_.begin() + done);
+                return -1;
+            }
+
+            done += size_t(count);
+            active_->size += uint64_t(count);
+        }
+
+        pending_.clear();
+        return 0;
+    }
+
+    // on the compaction thread: rewrite the sealed segments, 0 or errno
+    inline int compact()
+    {
+        std::vector<std::shared_ptr<RawLogSegment>> sealed;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (const auto& entry: segments_)
+            {
+                if (entry.second != active_)
+                {
+                    sealed.push_back(entry.second);
+                }
+            }
+        }
+
+        std::unordered_map<TK, uint64_t, TH> latest;
+        TK key;
+        uint64_t end;
+
+        auto note = [&](const RawRecordHeader& header, const char* payload, uint64_t)
+        {
+            deserialize(payload, key);
+            latest[key] = header.sequence;
+            return true;
+        };
+
+        for (const auto& segment: sealed)
+        {
+            if (scan_records(segment->fd, 0, segment->size, segment->first - 1, note, end) < 0)
+            {
+                return errno;
+            }
+            if (end != segment->size)
+            {
+                return EBADMSG;
+            }
+        }
+
+        for (const auto& segment: sealed)
+        {
+            auto compacted = std::make_shared<RawLogSegment>(segment->first, -1);
+            std::vector<char> buf;
+
+            auto keep = [&](const RawRecordHeader& header, const char* payload, uint64_t)
+            {
+                deserialize(payload, key);
+                if (latest.find(key)->second == header.sequence)
+                {
+                    compacted->track(header.sequence, buf.size(), index_interval_);
+                    buf.insert(buf.end(), payload - sizeof(header), payload + header.size);
+                }
+
+                return true;
+            };
+
+            if (scan_records(segment->fd, 0, segment->size, segment->first - 1, keep, end) < 0)
+            {
+                return errno;
+            }
+            if (buf.size() == segment->size)
+            {
+                continue; // nothing to drop
+            }
+
+            if (buf.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+
+                    segments_.erase(segment->first);
+                }
+
+                unlink(path_of(segment->first, ".index").c_str());
+                unlink(path_of(segment->first, ".log").c_str());
+                if (sync_directory(directory_) < 0)
+                {
+                    return errno;
+                }
+                continue;
+            }
+
+            // replaced durably, the directory synced as well
+            const std::string path = path_of(segment->first, ".log");
+
+            if (write_file_atomic(path, buf.data(), buf.size()) < 0)
+            {
+                return errno;
+            }
+
+            compacted->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+            compacted->size = buf.size();
+            if (compacted->fd < 0 || write_index(*compacted) < 0)
+            {
+                return errno;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            segments_[segment->first] = std::move(compacted);
+        }
+
+        return 0;
+    }
+
+    const std::string directory_;
+    const size_t segment_size_;
+    const size_t sync_size_;
+    const clock::duration sync_delay_;
+    const size_t index_interval_;
+
+    mutable std::mutex mutex_; // guards segments_, and active_ against the compaction
+    std::map<uint64_t, std::shared_ptr<RawLogSegment>> segments_;
+    std::shared_ptr<RawLogSegment> active_;
+
+    uint64_t next_;
+    std::vector<char> pending_;
+    clock::time_point deadline_;
+    bool unsynced_;
+    int sync_error_; // of a sync in append(), for the next sync()
+
+    std::thread compactor_;
+    std::atomic<bool> compacting_;
+    int compaction_error_;
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,386 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+crash recovery: a checkpoint of partitioned state loaded in parallel from a
+mapping, then the record log replayed in parallel by partition
+
+*/
+
+#pragma once
+
+#include <cerrno>     // for errno
+#include <chrono>     // for std::chrono::steady_clock
+#include <cstddef>    // for size_t
+#include <cstdint>    // for uint64_t
+#include <functional> // for std::hash
+#include <memory>     // for std::shared_ptr
+#include <string>
+#include <thread>     // for std::thread::hardware_concurrency
+#include <utility>    // for std::pair
+#include <vector>
+
+#include <fcntl.h>    // for open, O_*
+#include <sys/mman.h> // for mmap, munmap, madvise
+#include <sys/stat.h> // for fstat
+#include <unistd.h>   // for close
+
+#include "raw_file.h"
+#include "raw_parallel.h"
+#include "raw_record_log.h"
+
+namespace NAMESPACE
+{
+
+enum class RawRecoveryPhase
+{
+    load_checkpoint,    // count: bytes of the checkpoint
+    scan_log,           // count: records to replay
+    replay_log,         // count: records replayed
+};
+
+// instrumentation hook of a recovery doing nothing
+struct RawRecoveryNoHook
+{
+    inline void operator()(RawRecoveryPhase, std::chrono::steady_clock::duration, size_t) const
+    {
+    }
+};
+
+/*
+ * read-only mapping of a whole file
+ *
+ */
+class RawFileMapping
+{
+public:
+    RawFileMapping():
+        data_(nullptr), size_(0)
+    {
+    }
+
+    RawFileMapping(const RawFileMapping&) = delete;
+    RawFileMapping& operator=(const RawFileMapping&) = delete;
+
+    ~RawFileMapping()
+    {
+        if (size_ > 0)
+        {
+            munmap(data_, size_);
+        }
+    }
+
+    // map size bytes of fd, 0, or -1 with errno set
+    inline int map(int fd, size_t size)
+    {
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        void* const data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+        {
+            return -1;
+        }
+
+        madvise(data, size, MADV_WILLNEED);
+        data_ = data;
+        size_ = size;
+        return 0;
+    }
+
+    inline const char* data() const
+    {
+        return static_cast<const char*>(data_);
+    }
+
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    void* data_;
+    size_t size_;
+};
+
+/*
+ * recovery of state kept as partitions, TM maps of TK to TV for instance,
+ * with key in partition TH()(key) % partition count, and mutated by the
+ * records of a RawRecordLog<TK, TV, TH>
+ *
+ * checkpoint layout:
+ *
+ *      | uint64_t sequence, std::vector<uint64_t> sizes | partition 0 | ... |
+ *
+ * the checkpoint covers the records before sequence, its partitions are
+ * serialized and deserialized by thread_count threads
+ *
+ * on replay, the segments are scanned by thread_count threads, then each
+ * thread applies the records of its partitions, segment after segment,
+ * so the records of a key are applied in order
+ *
+ */
+template <typename TK, typename TV, typename TM, typename TH = std::hash<TK>>
+class RawRecovery
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit RawRecovery(size_t thread_count = std::thread::hardware_concurrency()):
+        thread_count_(thread_count > 0 ? thread_count : 1)
+    {
+    }
+
+    static inline size_t partition_of(const TK& key, size_t partition_count)
+    {
+        return TH()(key) % partition_count;
+    }
+
+    /*
+     * write partitions as the checkpoint at path, covering the records
+     * before sequence
+     * 0, or -1 with errno set
+     *
+     */
+    inline int checkpoint(const std::string& path, const std::vector<TM>& partitions,
+            uint64_t sequence) const
+    {
+        Header header(sequence, std::vector<uint64_t>(partitions.size()));
+        auto& sizes = header.second;
+
+        parallel_for(partitions.size(), thread_count_, [&](size_t idx)
+        {
+            sizes[idx] = serialized_size(partitions[idx]);
+        });
+
+        std::vector<size_t> offsets(partitions.size() + 1, serialized_size(header));
+
+        for (size_t idx = 0; idx < partitions.size(); ++idx)
+        {
+            offsets[idx + 1] = offsets[idx] + sizes[idx];
+        }
+
+        std::vector<char> buf(offsets.back());
+
+        serialize(buf.data(), header);
+        parallel_for(partitions.size(), thread_count_, [&](size_t idx)
+        {
+            serialize(buf.data() + offsets[idx], partitions[idx]);
+        });
+
+        return write_file_atomic(path, buf.data(), buf.size());
+    }
+
+    /*
+     * load the checkpoint at path into partitions, none keeps partitions as
+     * they are, then apply(partition, key, value) the records of log from
+     * the sequence of the checkpoint on, hook(phase, elapsed, count) after
+     * each phase
+     * 0, or -1 with errno set, EBADMSG for a corrupt checkpoint or segment
+     *
+     */
+    template <typename TF, typename THook = RawRecoveryNoHook>
+    inline int recover(const std::string& path, RawRecordLog<TK, TV, TH>& log,
+            std::vector<TM>& partitions, const TF& apply, const THook& hook = THook()) const
+    {
+        auto t0 = clock::now();
+        uint64_t sequence = 1;
+        size_t size = 0;
+
+        if (load(path, partitions, sequence, size) < 0)
+        {
+            if (errno != ENOENT)
+            {
+                return -1;
+            }
+        }
+        if (partitions.empty())
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        auto t1 = clock::now();
+
+        hook(RawRecoveryPhase::load_checkpoint, t1 - t0, size);
+
+        if (log.sync() < 0)
+        {
+            return -1;
+        }
+
+        // payloads to replay, by segment and by thread
+        const auto segments = log.segments_from(sequence);
+        std::vector<RawFileMapping> mappings(segments.size());
+        std::vector<std::vector<std::vector<const char*>>> payloads(segments.size(),
+                std::vector<std::vector<const char*>>(thread_count_));
+        std::vector<int> errors(segments.size(), 0);
+
+        parallel_for(segments.size(), thread_count_, [&](size_t idx)
+        {
+            errors[idx] = scan(*segments[idx], sequence, partitions.size(),
+                    mappings[idx], payloads[idx]);
+        });
+
+        size_t count = 0;
+
+        for (size_t idx = 0; idx < segments.size(); ++idx)
+        {
+            if (errors[idx] != 0)
+            {
+                errno = errors[idx];
+                return -1;
+            }
+
+            for (const auto& bucket: payloads[idx])
+            {
+                count += bucket.size();
+            }
+        }
+
+        auto t2 = clock::now();
+
+        hook(RawRecoveryPhase::scan_log, t2 - t1, count);
+
+        parallel_for(thread_count_, thread_count_, [&](size_t thread)
+        {
+            TK key;
+            TV value;
+
+            for (const auto& buckets: payloads)
+            {
+                for (auto payload: buckets[thread])
+                {
+                    deserialize(deserialize(payload, key), value);
+                    apply(partitions[partition_of(key, partitions.size())], key, value);
+                }
+            }
+        });
+
+        hook(RawRecoveryPhase::replay_log, clock::now() - t2, count);
+        return 0;
+    }
+
+private:
+    using Header = std::pair<uint64_t, std::vector<uint64_t>>; // sequence, sizes
+
+    // load the checkpoint at path, its sequence and its size in bytes
+    inline int load(const std::string& path, std::vector<TM>& partitions,
+            uint64_t& sequence, size_t& size) const
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        RawFileMapping mapping;
+
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (fstat(fd, &info) < 0 || mapping.map(fd, size_t(info.st_size)) < 0)
+        {
+            const int error = errno;
+
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        close(fd);
+
+        const char* const begin = mapping.data();
+        const char* const end = begin + mapping.size();
+        const char* head = validate<Header>(begin, end);
+        Header header;
+
+        if (head == nullptr)
+        {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        deserialize(begin, header);
+
+        std::vector<const char*> offsets(header.second.size() + 1, head);
+
+        for (size_t idx = 0; idx < header.second.size(); ++idx)
+        {
+            if (header.second[idx] > uint64_t(end - offsets[idx]))
+            {
+                errno = EBADMSG;
+                return -1;
+            }
+
+            offsets[idx + 1] = offsets[idx] + header.second[idx];
+        }
+
+        std::vector<char> bad(header.second.size(), false);
+
+        partitions.resize(header.second.size());
+        parallel_for(partitions.size(), thread_count_, [&](size_t idx)
+        {
+            if (validate<TM>(offsets[idx], offsets[idx + 1]) != offsets[idx + 1])
+            {
+                bad[idx] = true;
+                return;
+            }
+
+            deserialize(offsets[idx], partitions[idx]);
+        });
+
+        for (auto flag: bad)
+        {
+            if (flag)
+            {
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+
+        sequence = header.first;
+        size = mapping.size();
+        return 0;
+    }
+
+    // map segment, sort the payloads from sequence on by thread, 0 or errno
+    inline int scan(const RawLogSegment& segment, uint64_t sequence, size_t partition_count,
+            RawFileMapping& mapping, std::vector<std::vector<const char*>>& payloads) const
+    {
+        if (mapping.map(segment.fd, size_t(segment.size)) < 0)
+        {
+            return errno;
+        }
+
+        const char* const data = mapping.data();
+        uint64_t offset = segment.seek(sequence);
+        uint64_t after = segment.first - 1;
+        RawRecordHeader header;
+        TK key;
+
+        while (offset < segment.size)
+        {
+            if (!check_record(data + offset, segment.size - offset, after, header))
+            {
+                return EBADMSG;
+            }
+
+            const char* const payload = data + offset + sizeof(header);
+
+            if (header.sequence >= sequence)
+            {
+                deserialize(payload, key);
+                payloads[partition_of(key, partition_count) % thread_count_].push_back(payload);
+            }
+
+            after = header.sequence;
+            offset += sizeof(header) + header.size;
+        }
+
+        return 0;
+    }
+
+    const size_t thread_count_;
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,906 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+resumable deserialization from partial input,
+resumable serialization into partial output within a time budget
+
+*/
+
+#pragma once
+
+#include <chrono>  // for std::chrono::steady_clock
+#include <cstddef> // for size_t
+#include <cstring> // for memcpy
+#include <memory>  // for std::unique_ptr
+#include <tuple>
+#include <utility> // for std::pair, std::move
+
+#include "raw_stl.h"
+#include "raw_stream.h" // for RawContainerSize
+
+namespace NAMESPACE
+{
+
+/*
+ * decoder template class holding the progress of one object
+ *
+ *      bool step(const char*& buffer, const char* end, TO& object)
+ *          consume as much of [buffer, end) as possible, true once object is complete
+ *
+ *      size_t demand() const
+ *          bytes needed before the next progress, i.e. the rest of a size prefix
+ *          or of a copyable block
+ *
+ *      void reset()
+ *          start over for another object
+ *
+ * partially built containers are kept in object between steps, object must
+ * not be touched until the decoder completes
+ *
+ */
+template <typename TO, typename Test = void>
+struct RawResumableDecoder
+{
+    static_assert(is_zero_size_object<TO>::value,
+            "no suitable resumable decoder for TO found; " \
+            "please implement it.");
+};
+
+/*
+ * serialization-copyable type implementation
+ *
+ * the bytes go straight into the object, no staging
+ *
+ */
+template <typename TO>
+struct RawResumableDecoder<TO,
+        enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    size_t offset = 0;
+
+    inline bool step(const char*& buffer, const char* end, TO& object)
+    {
+        const size_t count = demand() < size_t(end - buffer) ? demand() : size_t(end - buffer);
+
+        memcpy(reinterpret_cast<char*>(&object) + offset, buffer, count);
+        buffer += count;
+        offset += count;
+
+        return offset == sizeof(TO);
+    }
+
+    inline size_t demand() const
+    {
+        return sizeof(TO) - offset;
+    }
+
+    inline void reset()
+    {
+        offset = 0;
+    }
+};
+
+/*
+ * for:
+ *      std::pair<TK, TV>
+ *
+ */
+template <typename TK, typename TV>
+struct RawResumableDecoder<std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    RawResumableDecoder<remove_const_t<TK>> first;
+    RawResumableDecoder<TV> second;
+    bool first_done = false;
+
+    inline bool step(const char*& buffer, const char* end, std::pair<TK, TV>& pair)
+    {
+        if (!first_done)
+        {
+            first_done = first.step(buffer, end, const_cast<remove_const_t<TK>&>(pair.first));
+            if (!first_done)
+            {
+                return false;
+            }
+        }
+
+        return second.step(buffer, end, pair.second);
+    }
+
+    inline size_t demand() const
+    {
+        return first_done ? second.demand() : first.demand();
+    }
+
+    inline void reset()
+    {
+        first.reset();
+        second.reset();
+        first_done = false;
+    }
+};
+
+/*
+ * for:
+ *      std::tuple<...Args>
+ *
+ */
+template <typename TT, size_t I, size_t N>
+struct RawResumableTupleHelper
+{
+    template <typename TD>
+    static inline bool step(TD& decoders, size_t& index,
+            const char*& buffer, const char* end, TT& tuple)
+    {
+        if (index == I)
+        {
+            if (!std::get<I>(decoders).step(buffer, end, std::get<I>(tuple)))
+            {
+                return false;
+            }
+
+            ++index;
+        }
+
+        return RawResumableTupleHelper<TT, I + 1, N>::step(decoders, index, buffer, end, tuple);
+    }
+
+    template <typename TD>
+    static inline size_t demand(const TD& decoders, size_t index)
+    {
+        return index == I ? std::get<I>(decoders).demand() :
+                RawResumableTupleHelper<TT, I + 1, N>::demand(decoders, index);
+    }
+
+    template <typename TD>
+    static inline void reset(TD& decoders)
+    {
+        std::get<I>(decoders).reset();
+        RawResumableTupleHelper<TT, I + 1, N>::reset(decoders);
+    }
+};
+
+template <typename TT, size_t N>
+struct RawResumableTupleHelper<TT, N, N>
+{
+    template <typename TD>
+    static inline bool step(TD&, size_t&, const char*&, const char*, TT&)
+    {
+        return true;
+    }
+
+    template <typename TD>
+    static inline size_t demand(const TD&, size_t)
+    {
+        return 0;
+    }
+
+    template <typename TD>
+    static inline void reset(TD&)
+    {
+    }
+};
+
+template <typename ...Args>
+struct RawResumableDecoder<std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    using TT = std::tuple<Args...>;
+    using TH = RawResumableTupleHelper<TT, 0, sizeof ...(Args)>;
+
+    std::tuple<RawResumableDecoder<Args>...> decoders;
+    size_t index = 0;
+
+    inline bool step(const char*& buffer, const char* end, TT& tuple)
+    {
+        return TH::step(decoders, index, buffer, end, tuple);
+    }
+
+    inline size_t demand() const
+    {
+        return TH::demand(decoders, index);
+    }
+
+    inline void reset()
+    {
+        TH::reset(decoders);
+        index = 0;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::string ...
+ *
+ * TO.resize(size_t) and contiguous copyable items, the items are one block
+ *
+ */
+template <class T>
+struct RawResumableDecoder<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value && // restricted to size_t
+            is_container_block_copyable<T>::value
+        >>
+{
+    using TI = value_type_t<T>;
+
+    RawResumableDecoder<size_t> size_decoder;
+    size_t size = 0;
+    size_t offset = 0;
+    bool sized = false;
+
+    inline bool step(const char*& buffer, const char* end, T& container)
+    {
+        if (!sized)
+        {
+            sized = size_decoder.step(buffer, end, size);
+            if (!sized)
+            {
+                return false;
+            }
+
+            container.resize(size);
+        }
+
+        const size_t count = demand() < size_t(end - buffer) ? demand() : size_t(end - buffer);
+
+        if (count > 0)
+        {
+            memcpy(reinterpret_cast<char*>(&*std::begin(container)) + offset, buffer, count);
+            buffer += count;
+            offset += count;
+        }
+
+        return offset == size * sizeof(TI);
+    }
+
+    inline size_t demand() const
+    {
+        return sized ? size * sizeof(TI) - offset : size_decoder.demand();
+    }
+
+    inline void reset()
+    {
+        size_decoder.reset();
+        offset = 0;
+        sized = false;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::deque<TI, ...>
+ *      std::forward_list<TI, ...>, std::list<TI, ...>
+ *
+ * TO.resize(size_t), items decoded in place one by one
+ *
+ */
+template <class T>
+struct RawResumableDecoder<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value && // restricted to size_t
+            !is_container_block_copyable<T>::value
+        >>
+{
+    using TI = value_type_t<T>;
+    using TIt = decltype(std::begin(std::declval<T&>()));
+
+    RawResumableDecoder<size_t> size_decoder;
+    RawResumableDecoder<TI> item_decoder;
+    size_t size = 0;
+    TIt item;
+    bool sized = false;
+
+    inline bool step(const char*& buffer, const char* end, T& container)
+    {
+        if (!sized)
+        {
+            sized = size_decoder.step(buffer, end, size);
+            if (!sized)
+            {
+                return false;
+            }
+
+            container.resize(size);
+            item = std::begin(container);
+        }
+
+        for (; item != std::end(container); ++item)
+        {
+            if (!item_decoder.step(buffer, end, *item))
+            {
+                return false;
+            }
+
+            item_decoder.reset();
+        }
+
+        return true;
+    }
+
+    inline size_t demand() const
+    {
+        return sized ? item_decoder.demand() : size_decoder.demand();
+    }
+
+    inline void reset()
+    {
+        size_decoder.reset();
+        item_decoder.reset();
+        sized = false;
+    }
+};
+
+/*
+ * for:
+ *      std::set<TI, ...>, std::map<TK, TV, ...>
+ *      std::unordered_map<TK, TV, ...> ...
+ *
+ * items decoded into a scratch one by one and emplaced
+ *
+ */
+template <class T>
+struct RawResumableDecoder<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !has_method_resize<T, size_t>::value && // restricted to size_t
+            has_method_emplace<T, value_type_t<T>>::value
+        >>
+{
+    using TI = mutable_value_type_t<T>;
+
+    RawResumableDecoder<size_t> size_decoder;
+    RawResumableDecoder<TI> item_decoder;
+    size_t size = 0;
+    TI item;
+    bool sized = false;
+
+    inline bool step(const char*& buffer, const char* end, T& container)
+    {
+        if (!sized)
+        {
+            sized = size_decoder.step(buffer, end, size);
+            if (!sized)
+            {
+                return false;
+            }
+
+            container.clear();
+        }
+
+        for (; size > 0; --size)
+        {
+            if (!item_decoder.step(buffer, end, item))
+            {
+                return false;
+            }
+
+            container.emplace(std::move(item));
+            item_decoder.reset();
+        }
+
+        return true;
+    }
+
+    inline size_t demand() const
+    {
+        return sized ? item_decoder.demand() : size_decoder.demand();
+    }
+
+    inline void reset()
+    {
+        size_decoder.reset();
+        item_decoder.reset();
+        sized = false;
+    }
+};
+
+/*
+ * for:
+ *      std::unique_ptr<T, ...>
+ *
+ */
+template <typename T, typename ...Args>
+struct RawResumableDecoder<std::unique_ptr<T, Args...>>
+{
+    RawResumableDecoder<bool> test_decoder;
+    RawResumableDecoder<T> item_decoder;
+    bool test = false;
+    bool tested = false;
+
+    inline bool step(const char*& buffer, const char* end, std::unique_ptr<T, Args...>& pointer)
+    {
+        if (!tested)
+        {
+            tested = test_decoder.step(buffer, end, test);
+            if (!tested)
+            {
+                return false;
+            }
+
+            pointer.reset(test ? new T : nullptr);
+        }
+
+        return !test || item_decoder.step(buffer, end, *pointer);
+    }
+
+    inline size_t demand() const
+    {
+        return tested ? (test ? item_decoder.demand() : 0) : test_decoder.demand();
+    }
+
+    inline void reset()
+    {
+        test_decoder.reset();
+        item_decoder.reset();
+        tested = false;
+    }
+};
+
+/*
+ * resumable deserializer: feed it chunks as they arrive
+ *
+ *      RawResumableDeserializer<T> decoder(object);
+ *      while (!decoder.done())
+ *      {
+ *          // wait for at least decoder.demand() more bytes ...
+ *          consumed = decoder.feed(data, size);
+ *      }
+ *
+ */
+template <typename TO>
+class RawResumableDeserializer
+{
+public:
+    explicit RawResumableDeserializer(TO& object):
+        object_(object), done_(false)
+    {
+    }
+
+    // decode from size bytes of data, the number of bytes consumed
+    inline size_t feed(const char* data, size_t size)
+    {
+        const char* buffer = data;
+
+        if (!done_)
+        {
+            done_ = decoder_.step(buffer, data + size, object_);
+        }
+
+        return size_t(buffer - data);
+    }
+
+    inline bool done() const
+    {
+        return done_;
+    }
+
+    // bytes needed before the next progress, 0 once done
+    inline size_t demand() const
+    {
+        return done_ ? 0 : decoder_.demand();
+    }
+
+    // start over for another object
+    inline void reset()
+    {
+        decoder_.reset();
+        done_ = false;
+    }
+
+private:
+    TO& object_;
+    RawResumableDecoder<TO> decoder_;
+    bool done_;
+};
+
+/*
+ * time budget of a resumable serialization, checked between container items,
+ * the clock is read every stride items
+ *
+ */
+class RawTimeBudget
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit RawTimeBudget(clock::duration budget, size_t stride = 64):
+        deadline_(clock::now() + budget), stride_(stride), count_(0)
+    {
+    }
+
+    inline bool expired()
+    {
+        if (++count_ < stride_)
+        {
+            return false;
+        }
+
+        count_ = 0;
+        return clock::now() >= deadline_;
+    }
+
+private:
+    const clock::time_point deadline_;
+    const size_t stride_;
+    size_t count_;
+};
+
+/*
+ * encoder template class holding the progress of one object
+ *
+ *      bool step(char*& buffer, char* end, const TO& object, RawTimeBudget& budget)
+ *          fill as much of [buffer, end) as possible, true once object is complete
+ *          false as well when the budget expires, between container items
+ *
+ *      void reset()
+ *          start over for another object
+ *
+ * object must not be modified until the encoder completes
+ *
+ */
+template <typename TO, typename Test = void>
+struct RawResumableEncoder
+{
+    static_assert(is_zero_size_object<TO>::value,
+            "no suitable resumable encoder for TO found; " \
+            "please implement it.");
+};
+
+/*
+ * serialization-copyable type implementation
+ *
+ */
+template <typename TO>
+struct RawResumableEncoder<TO,
+        enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    size_t offset = 0;
+
+    inline bool step(char*& buffer, char* end, const TO& object, RawTimeBudget&)
+    {
+        const size_t rest = sizeof(TO) - offset;
+        const size_t count = rest < size_t(end - buffer) ? rest : size_t(end - buffer);
+
+        memcpy(buffer, reinterpret_cast<const char*>(&object) + offset, count);
+        buffer += count;
+        offset += count;
+
+        return offset == sizeof(TO);
+    }
+
+    inline void reset()
+    {
+        offset = 0;
+    }
+};
+
+/*
+ * for:
+ *      std::pair<TK, TV>
+ *
+ */
+template <typename TK, typename TV>
+struct RawResumableEncoder<std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    RawResumableEncoder<remove_const_t<TK>> first;
+    RawResumableEncoder<TV> second;
+    bool first_done = false;
+
+    inline bool step(char*& buffer, char* end, const std::pair<TK, TV>& pair,
+            RawTimeBudget& budget)
+    {
+        if (!first_done)
+        {
+            first_done = first.step(buffer, end, pair.first, budget);
+            if (!first_done)
+            {
+                return false;
+            }
+        }
+
+        return second.step(buffer, end, pair.second, budget);
+    }
+
+    inline void reset()
+    {
+        first.reset();
+        second.reset();
+        first_done = false;
+    }
+};
+
+/*
+ * for:
+ *      std::tuple<...Args>
+ *
+ */
+template <typename TT, size_t I, size_t N>
+struct RawResumableEncoderTupleHelper
+{
+    template <typename TE>
+    static inline bool step(TE& encoders, size_t& index,
+            char*& buffer, char* end, const TT& tuple, RawTimeBudget& budget)
+    {
+        if (index == I)
+        {
+            if (!std::get<I>(encoders).step(buffer, end, std::get<I>(tuple), budget))
+            {
+                return false;
+            }
+
+            ++index;
+        }
+
+        return RawResumableEncoderTupleHelper<TT, I + 1, N>::step(
+                encoders, index, buffer, end, tuple, budget);
+    }
+
+    template <typename TE>
+    static inline void reset(TE& encoders)
+    {
+        std::get<I>(encoders).reset();
+        RawResumableEncoderTupleHelper<TT, I + 1, N>::reset(encoders);
+    }
+};
+
+template <typename TT, size_t N>
+struct RawResumableEncoderTupleHelper<TT, N, N>
+{
+    template <typename TE>
+    static inline bool step(TE&, size_t&, char*&, char*, const TT&, RawTimeBudget&)
+    {
+        return true;
+    }
+
+    template <typename TE>
+    static inline void reset(TE&)
+    {
+    }
+};
+
+template <typename ...Args>
+struct RawResumableEncoder<std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    using TT = std::tuple<Args...>;
+    using TH = RawResumableEncoderTupleHelper<TT, 0, sizeof ...(Args)>;
+
+    std::tuple<RawResumableEncoder<Args>...> encoders;
+    size_t index = 0;
+
+    inline bool step(char*& buffer, char* end, const TT& tuple, RawTimeBudget& budget)
+    {
+        return TH::step(encoders, index, buffer, end, tuple, budget);
+    }
+
+    inline void reset()
+    {
+        TH::reset(encoders);
+        index = 0;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::string ...
+ *
+ * contiguous copyable items, the items are one block
+ *
+ */
+template <class T>
+struct RawResumableEncoder<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            is_container_block_copyable<T>::value
+        >>
+{
+    using TI = value_type_t<T>;
+
+    RawResumableEncoder<size_t> size_encoder;
+    size_t size = 0;
+    size_t offset = 0;
+    bool sized = false;
+
+    inline bool step(char*& buffer, char* end, const T& container, RawTimeBudget& budget)
+    {
+        if (!sized)
+        {
+            size = container.size();
+            sized = size_encoder.step(buffer, end, size, budget);
+            if (!sized)
+            {
+                return false;
+            }
+        }
+
+        const size_t rest = size * sizeof(TI) - offset;
+        const size_t count = rest < size_t(end - buffer) ? rest : size_t(end - buffer);
+
+        if (count > 0)
+        {
+            memcpy(buffer, reinterpret_cast<const char*>(&*std::begin(container)) + offset, count);
+            buffer += count;
+            offset += count;
+        }
+
+        return offset == size * sizeof(TI);
+    }
+
+    inline void reset()
+    {
+        size_encoder.reset();
+        offset = 0;
+        sized = false;
+    }
+};
+
+/*
+ * for:
+ *      std::deque<TI, ...>, std::forward_list<TI, ...>, std::list<TI, ...>
+ *      std::set<TI, ...>, std::map<TK, TV, ...> ...
+ *
+ * items encoded one by one, the budget is checked between them
+ *
+ */
+template <class T>
+struct RawResumableEncoder<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !is_container_block_copyable<T>::value
+        >>
+{
+    using TI = remove_const_t<value_type_t<T>>;
+    using TIt = decltype(std::begin(std::declval<const T&>()));
+
+    RawResumableEncoder<size_t> size_encoder;
+    RawResumableEncoder<TI> item_encoder;
+    size_t size = 0;
+    TIt item;
+    bool sized = false;
+
+    inline bool step(char*& buffer, char* end, const T& container, RawTimeBudget& budget)
+    {
+        if (!sized)
+        {
+            size = RawContainerSize<T>()(container);
+            sized = size_encoder.step(buffer, end, size, budget);
+            if (!sized)
+            {
+                return false;
+            }
+
+            item = std::begin(container);
+        }
+
+        for (; item != std::end(container); ++item)
+        {
+            if (!item_encoder.step(buffer, end, *item, budget))
+            {
+                return false;
+            }
+
+            item_encoder.reset();
+            if (budget.expired())
+            {
+                ++item;
+                return item == std::end(container);
+            }
+        }
+
+        return true;
+    }
+
+    inline void reset()
+    {
+        size_encoder.reset();
+        item_encoder.reset();
+        sized = false;
+    }
+};
+
+/*
+ * for:
+ *      std::unique_ptr<T, ...>
+ *
+ */
+template <typename T, typename ...Args>
+struct RawResumableEncoder<std::unique_ptr<T, Args...>>
+{
+    RawResumableEncoder<bool> test_encoder;
+    RawResumableEncoder<T> item_encoder;
+    bool test = false;
+    bool tested = false;
+
+    inline bool step(char*& buffer, char* end, const std::unique_ptr<T, Args...>& pointer,
+            RawTimeBudget& budget)
+    {
+        if (!tested)
+        {
+            test = pointer != nullptr;
+            tested = test_encoder.step(buffer, end, test, budget);
+            if (!tested)
+            {
+                return false;
+            }
+        }
+
+        return !test || item_encoder.step(buffer, end, *pointer, budget);
+    }
+
+    inline void reset()
+    {
+        test_encoder.reset();
+        item_encoder.reset();
+        tested = false;
+    }
+};
+
+/*
+ * resumable serializer: the continuation token of a time-budgeted serialization
+ *
+ *      RawResumableSerializer<T> serializer(object);
+ *      while (!serializer.done())
+ *      {
+ *          size = serializer.resume(data, capacity, std::chrono::microseconds(500));
+ *          // send [data, data + size), the rest of the frame ...
+ *      }
+ *
+ * every resume() stops when the buffer is full or the budget expires, the
+ * concatenated output is that of serialize(object)
+ *
+ */
+template <typename TO>
+class RawResumableSerializer
+{
+public:
+    explicit RawResumableSerializer(const TO& object):
+        object_(object), done_(false)
+    {
+    }
+
+    // encode into size bytes of data within budget, the number of bytes written
+    inline size_t resume(char* data, size_t size, RawTimeBudget::clock::duration budget)
+    {
+        RawTimeBudget time_budget(budget);
+        char* buffer = data;
+
+        if (!done_)
+        {
+            done_ = encoder_.step(buffer, data + size, object_, time_budget);
+        }
+
+        return size_t(buffer - data);
+    }
+
+    inline bool done() const
+    {
+        return done_;
+    }
+
+    // start over for the object
+    inline void reset()
+    {
+        encoder_.reset();
+        done_ = false;
+    }
+
+private:
+    const TO& object_;
+    RawResumableEncoder<TO> encoder_;
+    bool done_;
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,232 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+lock-free single-producer/single-consumer byte ring, serialize in place
+
+*/
+
+#pragma once
+
+#include <atomic>  // for std::atomic
+#include <cstddef> // for size_t
+#include <memory>  // for std::unique_ptr
+
+#include "raw.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * destructive interference size, keep producer and consumer indices apart
+ *
+ */
+static const size_t raw_cache_line_size = 64;
+
+/*
+ * single-producer/single-consumer ring of serialized records
+ *
+ * record layout, aligned to size_t:
+ *
+ *      | size_t size | payload[size] | padding |
+ *
+ * a record never wraps, if the tail room is too small the producer writes
+ * a wrap mark as size and the record starts over from the ring head
+ *
+ * producer:    reserve(size) -> serialize(...) -> publish()
+ * consumer:    peek(size) -> deserialize(...) -> release()
+ *
+ * head and tail grow monotonically, the producer and the consumer each cache
+ * the index owned by the other side to avoid bouncing its cache line
+ *
+ */
+class RawSpscRing
+{
+public:
+    explicit RawSpscRing(size_t capacity):
+        capacity_(round_capacity(capacity)),
+        mask_(capacity_ - 1),
+        storage_(new size_t[capacity_ / sizeof(size_t)]),
+        head_(0), head_pending_(0), tail_cache_(0),
+        tail_(0), tail_pending_(0), head_cache_(0)
+    {
+    }
+
+    RawSpscRing(const RawSpscRing&) = delete;
+    RawSpscRing& operator=(const RawSpscRing&) = delete;
+
+    inline size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /*
+     * largest payload a record can hold, wherever the ring head is: a record
+     * not fitting before the wrap takes the room up to it as well, which is
+     * less than the record itself
+     *
+     */
+    inline size_t max_size() const
+    {
+        return capacity_ / 2 - sizeof(size_t);
+    }
+
+    /*
+     * producer: reserve contiguous size bytes, nullptr if the ring is full
+     * the reservation is invisible to the consumer until publish()
+     *
+     */
+    inline char* reserve(size_t size)
+    {
+        const size_t record = sizeof(size_t) + align(size);
+
+        if (size > max_size())
+        {
+            return nullptr;
+        }
+
+        size_t head = head_.load(std::memory_order_relaxed);
+        const size_t room = capacity_ - (head & mask_);
+        const size_t demand = record > room ? room + record : record;
+
+        if (head + demand - tail_cache_ > capacity_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head + demand - tail_cache_ > capacity_)
+            {
+                return nullptr;
+            }
+        }
+
+        if (record > room)
+        {
+            const size_t mark = wrap_mark;
+
+            serialize(base() + (head & mask_), mark);
+            head += room;
+        }
+
+        const auto buffer = serialize(base() + (head & mask_), size);
+
+        head_pending_ = head + record;
+        return buffer;
+    }
+
+    // producer: make the last reservation visible to the consumer
+    inline void publish()
+    {
+        head_.store(head_pending_, std::memory_order_release);
+    }
+
+    /*
+     * consumer: the oldest published record and its size, nullptr if empty
+     * the record stays valid until release()
+     *
+     */
+    inline const char* peek(size_t& size)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail == head_cache_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_)
+            {
+                return nullptr;
+            }
+        }
+
+        const char* buffer = deserialize(base() + (tail & mask_), size);
+        if (size == wrap_mark)
+        {
+            tail += capacity_ - (tail & mask_);
+            buffer = deserialize(base(), size);
+        }
+
+        tail_pending_ = tail + sizeof(size_t) + align(size);
+        return buffer;
+    }
+
+    // consumer: hand the space of the last peeked record back to the producer
+    inline void release()
+    {
+        tail_.store(tail_pending_, std::memory_order_release);
+    }
+
+    // producer: serialize object as a record, false if the ring is full
+    template <typename TO>
+    inline bool push(const TO& object)
+    {
+        const auto buffer = reserve(serialized_size(object));
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        serialize(buffer, object);
+        publish();
+        return true;
+    }
+
+    // consumer: deserialize the oldest record in place, false if the ring is empty
+    template <typename TO>
+    inline bool pop(TO& object)
+    {
+        size_t size;
+        const auto buffer = peek(size);
+
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        deserialize(buffer, object);
+        release();
+        return true;
+    }
+
+private:
+    static const size_t wrap_mark = ~size_t(0);
+
+    static inline size_t align(size_t size)
+    {
+        return (size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    }
+
+    static inline size_t round_capacity(size_t capacity)
+    {
+        size_t result = 2 * sizeof(size_t);
+
+        while (result < capacity)
+        {
+            result <<= 1;
+        }
+
+        return result;
+    }
+
+    inline char* base() const
+    {
+        return reinterpret_cast<char*>(storage_.get());
+    }
+
+    // shared, read-only
+    const size_t capacity_;
+    const size_t mask_;
+    const std::unique_ptr<size_t[]> storage_;
+
+    // producer side
+    alignas(raw_cache_line_size) std::atomic<size_t> head_;
+    size_t head_pending_;
+    size_t tail_cache_;
+
+    // consumer side
+    alignas(raw_cache_line_size) std::atomic<size_t> tail_;
+    size_t tail_pending_;
+    size_t head_cache_;
+
+    char padding_[raw_cache_line_size - 3 * sizeof(size_t)];
+};
+
+} // namespace NAMESPACE
@@ -0,0 +1,226 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+segmented rope output: serialization across a chain of pooled blocks,
+exported as iovecs for writev
+
+*/
+
+#pragma once
+
+#include <cerrno>   // for errno
+#include <climits>  // for IOV_MAX
+#include <cstddef>  // for size_t
+#include <cstring>  // for memcpy
+#include <memory>   // for std::unique_ptr
+#include <vector>
+
+#include <sys/types.h> // for ssize_t
+#include <sys/uio.h>   // for iovec, writev
+
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * pool of fixed-size blocks, recycled instead of freed
+ * not thread-safe, one pool per thread
+ *
+ */
+class RawBlockPool
+{
+public:
+    explicit RawBlockPool(size_t block_size = 1 << 16):
+        block_size_(block_size)
+    {
+    }
+
+    RawBlockPool(const RawBlockPool&) = delete;
+    RawBlockPool& operator=(const RawBlockPool&) = delete;
+
+    inline char* acquire()
+    {
+        if (free_.empty())
+        {
+            return new char[block_size_];
+        }
+
+        char* const block = free_.back().release();
+
+        free_.pop_back();
+        return block;
+    }
+
+    inline void release(char* block)
+    {
+        free_.emplace_back(block);
+    }
+
+    inline size_t block_size() const
+    {
+        return block_size_;
+    }
+
+    // blocks kept for reuse
+    inline size_t idle() const
+    {
+        return free_.size();
+    }
+
+private:
+    const size_t block_size_;
+    std::vector<std::unique_ptr<char[]>> free_;
+};
+
+/*
+ * rope writer: stream policy filling blocks from a RawBlockPool
+ *
+ * the output never moves once written: growing takes one more block,
+ * copyable blocks are split at block boundaries
+ *
+ */
+class RawRopeWriter
+{
+public:
+    explicit RawRopeWriter(RawBlockPool& pool):
+        pool_(pool), fill_(pool.block_size()), size_(0)
+    {
+    }
+
+    RawRopeWriter(const RawRopeWriter&) = delete;
+    RawRopeWriter& operator=(const RawRopeWriter&) = delete;
+
+    ~RawRopeWriter()
+    {
+        clear();
+    }
+
+    inline void write(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+        const size_t block_size = pool_.block_size();
+
+        size_ += size;
+        while (size > 0)
+        {
+            if (fill_ == block_size)
+            {
+                blocks_.push_back(pool_.acquire());
+                fill_ = 0;
+            }
+
+            const size_t count = size < block_size - fill_ ? size : block_size - fill_;
+
+            memcpy(blocks_.back() + fill_, bytes, count);
+            fill_ += count;
+            bytes += count;
+            size -= count;
+        }
+    }
+
+    // bytes written so far
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    // the segments in order, every one full but the last
+    inline std::vector<iovec> iovecs() const
+    {
+        std::vector<iovec> segments(blocks_.size());
+
+        for (size_t idx = 0; idx < blocks_.size(); ++idx)
+        {
+            segments[idx].iov_base = blocks_[idx];
+            segments[idx].iov_len = pool_.block_size();
+        }
+        if (!segments.empty())
+        {
+            segments.back().iov_len = fill_;
+        }
+
+        return segments;
+    }
+
+    // give the blocks back to the pool
+    inline void clear()
+    {
+        for (auto block: blocks_)
+        {
+            pool_.release(block);
+        }
+        blocks_.clear();
+        fill_ = pool_.block_size();
+        size_ = 0;
+    }
+
+private:
+    RawBlockPool& pool_;
+    std::vector<char*> blocks_;
+    size_t fill_;
+    size_t size_;
+};
+
+/*
+ * write rope from byte offset on to fd with writev, IOV_MAX segments a
+ * call, as far as fd takes it, the bytes written, or -1 with errno set if
+ * none were
+ *
+ * short of rope.size() - offset when a non-blocking fd would block or an
+ * error comes after some bytes, as write() is; the caller resumes from
+ * offset plus the bytes written:
+ *
+ *      for (size_t offset = 0; offset < rope.size(); offset += count)
+ *      {
+ *          count = write_rope(fd, rope, offset);
+ *          // on -1: wait for POLLOUT on EAGAIN, give up on the rest
+ *      }
+ *
+ */
+inline ssize_t write_rope(int fd, const RawRopeWriter& rope, size_t offset = 0)
+{
+    auto segments = rope.iovecs();
+    size_t head = 0;
+    ssize_t total = 0;
+
+    // skip size bytes, resume in the middle of a segment
+    auto skip = [&](size_t size)
+    {
+        for (; head < segments.size() && size >= segments[head].iov_len; ++head)
+        {
+            size -= segments[head].iov_len;
+        }
+        if (size > 0 && head < segments.size())
+        {
+            segments[head].iov_base = static_cast<char*>(segments[head].iov_base) + size;
+            segments[head].iov_len -= size;
+        }
+    };
+
+    skip(offset);
+    while (head < segments.size())
+    {
+        const size_t count = segments.size() - head < size_t(IOV_MAX) ?
+                segments.size() - head : size_t(IOV_MAX);
+        const ssize_t written = writev(fd, segments.data() + head, int(count));
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return total > 0 ? total : -1;
+        }
+
+        total += written;
+        skip(size_t(written));
+    }
+
+    return total;
+}
+
+} // namespace NAMESPACE
@@ -0,0 +1,230 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+background snapshots: a forked child serializes the copy-on-write image of
+an object to a file while the parent goes on
+
+*/
+
+#pragma once
+
+#include <cerrno>   // for errno
+#include <cstddef>  // for size_t
+#include <string>
+
+#include <fcntl.h>     // for open, O_*
+#include <stdio.h>     // for rename
+#include <sys/types.h> // for pid_t, ssize_t
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for fork, pipe2, write, read, fsync, unlink, _exit
+
+#include "raw_file.h" // for parent_directory, sync_directory
+#include "raw_stream.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * one background snapshot
+ *
+ * the child streams the object through serialize_chunked() into
+ * "<path>.tmp", syncs it, renames it to path and syncs the directory, so
+ * path always holds a complete snapshot, and "<path>.tmp" is removed on
+ * failure; its errno, 0 on success, comes back through a pipe
+ *
+ * the object must be consistent at start(), the child must not need any
+ * lock held by another thread of the parent (malloc excepted)
+ *
+ */
+class RawSnapshot
+{
+public:
+    RawSnapshot():
+        pid_(-1), fd_(-1), error_(0)
+    {
+    }
+
+    RawSnapshot(const RawSnapshot&) = delete;
+    RawSnapshot& operator=(const RawSnapshot&) = delete;
+
+    ~RawSnapshot()
+    {
+        if (running())
+        {
+            wait();
+        }
+    }
+
+    // fork the child, 0 or -1 with errno set
+    template <typename TO>
+    inline int start(const TO& object, const std::string& path, size_t chunk_size = 1 << 20)
+    {
+        int fds[2];
+
+        if (running())
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        if (pipe2(fds, O_CLOEXEC) < 0)
+        {
+            return -1;
+        }
+
+        const pid_t pid = fork();
+
+        if (pid < 0)
+        {
+            const int error = errno;
+
+            close(fds[0]);
+            close(fds[1]);
+            errno = error;
+            return -1;
+        }
+
+        if (pid == 0)
+        {
+            // the child leaves through _exit() only, never unwinding the stack of the parent
+            int error;
+
+            close(fds[0]);
+            try
+            {
+                error = dump(object, path, chunk_size);
+            }
+            catch (...)
+            {
+                error = EIO;
+                unlink((path + ".tmp").c_str());
+            }
+
+            report(fds[1], error);
+        }
+
+        close(fds[1]);
+        pid_ = pid;
+        fd_ = fds[0];
+        error_ = 0;
+        return 0;
+    }
+
+    inline bool running() const
+    {
+        return pid_ > 0;
+    }
+
+    // readable once the child is done, for poll() or epoll
+    inline int fd() const
+    {
+        return fd_;
+    }
+
+    // wait for the child, 0 or -1 with errno set to the failure of the snapshot
+    inline int wait()
+    {
+        if (!running())
+        {
+            errno = error_;
+            return error_ == 0 ? 0 : -1;
+        }
+
+        int error = 0;
+        ssize_t count;
+        int status;
+
+        do
+        {
+            count = read(fd_, &error, sizeof(error));
+        }
+        while (count < 0 && errno == EINTR);
+
+        if (count != ssize_t(sizeof(error)))
+        {
+            error = EIO; // the child died without a report
+        }
+
+        while (waitpid(pid_, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+
+        close(fd_);
+        pid_ = -1;
+        fd_ = -1;
+        error_ = error;
+
+        errno = error_;
+        return error_ == 0 ? 0 : -1;
+    }
+
+private:
+    // in the child: serialize object to path, 0 or errno
+    template <typename TO>
+    static inline int dump(const TO& object, const std::string& path, size_t chunk_size)
+    {
+        const std::string temp_path = path + ".tmp";
+        const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            return errno;
+        }
+
+        int error = 0;
+
+        serialize_chunked(object, chunk_size, [&](const char* data, size_t size)
+        {
+            while (error == 0 && size > 0)
+            {
+                const ssize_t count = ::write(fd, data, size);
+
+                if (count < 0)
+                {
+                    error = errno == EINTR ? 0 : errno;
+                    continue;
+                }
+
+                data += count;
+                size -= size_t(count);
+            }
+        });
+
+        if (error == 0 && fsync(fd) < 0)
+        {
+            error = errno;
+        }
+        if (close(fd) < 0 && error == 0)
+        {
+            error = errno;
+        }
+        if (error == 0 && rename(temp_path.c_str(), path.c_str()) < 0)
+        {
+            error = errno;
+        }
+        if (error != 0)
+        {
+            unlink(temp_path.c_str());
+            return error;
+        }
+
+        return sync_directory(parent_directory(path)) < 0 ? errno : 0;
+    }
+
+    // in the child: report error to the parent and leave
+    [[noreturn]] static inline void report(int fd, int error)
+    {
+        while (::write(fd, &error, sizeof(error)) < 0 && errno == EINTR)
+        {
+        }
+
+        _exit(error == 0 ? 0 : 1);
+    }
+
+    pid_t pid_;
+    int fd_;
+    int error_;
+};
+
+} // namespace NAMESPACE
@@ -80,6 +80,7 @@ the very ealy version looks like:
 #pragma once
 
 #include <cstddef>   // for size_t
+#include <cstring>   // for memcmp
 #include <utility>   // for std::pair, std::tuple
 
 #include "raw.h"
@@ -111,6 +112,34 @@ struct RawSerializationMultiplexer<F, TB, std::pair<TK, TV>,
     }
 };
 
+template <typename TB, typename TK, typename TV>
+struct RawSkipper<TB, std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    inline TB operator()(TB buffer) const
+    {
+        buffer = RawSkipper<TB, remove_const_t<TK>>()(buffer);
+        buffer = RawSkipper<TB, TV>()(buffer);
+
+        return buffer;
+    }
+};
+
+template <typename TB, typename TK, typename TV>
+struct RawValidator<TB, std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        return RawValidator<TB, remove_const_t<TK>>()(buffer, end, demand) &&
+                RawValidator<TB, TV>()(buffer, end, demand);
+    }
+};
+
 /*
  * for:
  *      std::tuple<...Args>
@@ -158,6 +187,74 @@ struct RawSerializationMultiplexer<F, TB, std::tuple<Args...>,
     }
 };
 
+template <typename TB, typename ...Args>
+struct RawTupleSkipHelper;
+
+template <typename TB, typename T0, typename ...Args>
+struct RawTupleSkipHelper<TB, T0, Args...>
+{
+    static inline TB call(TB buffer)
+    {
+        buffer = RawSkipper<TB, remove_const_t<T0>>()(buffer);
+        return RawTupleSkipHelper<TB, Args...>::call(buffer);
+    }
+};
+
+template <typename TB>
+struct RawTupleSkipHelper<TB>
+{
+    static inline TB call(TB buffer)
+    {
+        return buffer;
+    }
+};
+
+template <typename TB, typename ...Args>
+struct RawSkipper<TB, std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    inline TB operator()(TB buffer) const
+    {
+        return RawTupleSkipHelper<TB, Args...>::call(buffer);
+    }
+};
+
+template <typename TB, typename ...Args>
+struct RawTupleValidationHelper;
+
+template <typename TB, typename T0, typename ...Args>
+struct RawTupleValidationHelper<TB, T0, Args...>
+{
+    static inline bool call(TB& buffer, TB end, size_t& demand)
+    {
+        return RawValidator<TB, remove_const_t<T0>>()(buffer, end, demand) &&
+                RawTupleValidationHelper<TB, Args...>::call(buffer, end, demand);
+    }
+};
+
+template <typename TB>
+struct RawTupleValidationHelper<TB>
+{
+    static inline bool call(TB& /*buffer*/, TB /*end*/, size_t& /*demand*/)
+    {
+        return true;
+    }
+};
+
+template <typename TB, typename ...Args>
+struct RawValidator<TB, std::tuple<Args...>,
+        enable_if_t<
+            !is_serialization_copyable<std::tuple<Args...>>::value
+        >>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        return RawTupleValidationHelper<TB, Args...>::call(buffer, end, demand);
+    }
+};
+
 /*
  * for:
  *      std::vector<TI, ...>, std::deque<TI, ...>
@@ -188,6 +285,7 @@ template <template <typename...> class  F, typename TB,
 struct RawSerializationMultiplexer<F, TB, T,
         enable_if_t<
             is_non_default_serializable_container_type<T>::value &&
+            !is_stream_buffer<TB>::value &&
             has_method_size_with_ret<T, size_t(void)>::value &&
             (std::is_same<F<TB, T>, RawSerializer<TB, T>>::value ||
                 // non-copyable TI uses standard container serialization
@@ -232,6 +330,145 @@ struct RawDrySerializer<TB, T,
     }
 };
 
+/*
+ * for:
+ *      std::vector<TI, ...>, std::deque<TI, ...>
+ *      std::set<TI, ...>, std::map<TK, TV, ...> ...
+ *
+ * skip fast-forward version, by the size prefix
+ *
+ */
+template <typename TB, class T>
+struct RawSkipper<TB, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            is_serialization_copyable<value_type_t<T>>::value
+        >>
+{
+    using TI = value_type_t<T>;
+
+    inline TB operator()(TB buffer) const
+    {
+        size_t size;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+        return buffer + relative_size_of<TI, decltype(*buffer)>::value * size;
+    }
+};
+
+/*
+ * skip standard version, walking the size prefixes only
+ *
+ */
+template <typename TB, class T>
+struct RawSkipper<TB, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !is_serialization_copyable<value_type_t<T>>::value
+        >>
+{
+    using TI = mutable_value_type_t<T>;
+
+    inline TB operator()(TB buffer) const
+    {
+        size_t size;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+        for (; size > 0; --size)
+        {
+            buffer = RawSkipper<TB, TI>()(buffer);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::deque<TI, ...>
+ *      std::set<TI, ...>, std::map<TK, TV, ...> ...
+ *
+ * validation fast version, the items are one block checked at once
+ *
+ */
+template <typename TB, class T>
+struct RawValidator<TB, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            is_serialization_copyable<value_type_t<T>>::value
+        >>
+{
+    using TI = value_type_t<T>;
+
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        const auto size_head = buffer;
+
+        size_t size;
+
+        if (!RawValidator<TB, size_t>()(buffer, end, demand))
+        {
+            return false;
+        }
+
+        RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(size_head, size);
+        if (size > size_t(end - buffer) / relative_size_of<TI, decltype(*buffer)>::value)
+        {
+            return false;
+        }
+
+        demand += sizeof(TI) * size;
+        buffer += relative_size_of<TI, decltype(*buffer)>::value * size;
+        return true;
+    }
+};
+
+/*
+ * validation standard version, item by item
+ *
+ * every item takes at least one unit of TB, a size prefix beyond the
+ * buffer end is rejected before any item
+ *
+ */
+template <typename TB, class T>
+struct RawValidator<TB, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !is_serialization_copyable<value_type_t<T>>::value
+        >>
+{
+    using TI = mutable_value_type_t<T>;
+
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        const auto size_head = buffer;
+
+        size_t size;
+
+        if (!RawValidator<TB, size_t>()(buffer, end, demand))
+        {
+            return false;
+        }
+
+        RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(size_head, size);
+        if (size > size_t(end - buffer))
+        {
+            return false;
+        }
+
+        demand += sizeof(TI) * size;
+        for (; size > 0; --size)
+        {
+            if (!RawValidator<TB, TI>()(buffer, end, demand))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
 /*
  * for:
  *      std::vector<TI, ...>, std::deque<TI, ...>
@@ -246,6 +483,7 @@ template <typename TB, class T>
 struct RawDeserializer<TB, T,
         enable_if_t<
             is_non_default_serializable_container_type<T>::value &&
+            !is_stream_buffer<TB>::value &&
             has_method_resize<T, size_t>::value // restricted to size_t
         >>
 {
@@ -277,6 +515,7 @@ template <typename TB, class T>
 struct RawSerializer<TB, T,
         enable_if_t<
             is_non_default_serializable_container_type<T>::value &&
+            !is_stream_buffer<TB>::value &&
             !has_method_size_with_ret<T, size_t(void)>::value // restricted to size_t
         >>
 {
@@ -334,6 +573,7 @@ template <typename TB, class T>
 struct RawDeserializer<TB, T,
         enable_if_t<
             is_non_default_serializable_container_type<T>::value &&
+            !is_stream_buffer<TB>::value &&
             !has_method_resize<T, size_t>::value && // restricted to size_t
             is_container_batch_insertable<T>::value
         >>
@@ -364,6 +604,7 @@ template <typename TB, class T>
 struct RawDeserializer<TB, T,
         enable_if_t<
             is_non_default_serializable_container_type<T>::value &&
+            !is_stream_buffer<TB>::value &&
             !has_method_resize<T, size_t>::value && // restricted to size_t
             !is_container_batch_insertable<T>::value &&
             has_method_emplace<T, value_type_t<T>>::value
@@ -433,4 +674,53 @@ struct RawDeserializer<TB, std::unique_ptr<T, Args...>>
     }
 };
 
+template <typename TB, typename T, typename ...Args>
+struct RawSkipper<TB, std::unique_ptr<T, Args...>>
+{
+    inline TB operator()(TB buffer) const
+    {
+        bool test;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, bool>()(buffer, test);
+        if (test)
+        {
+            buffer = RawSkipper<TB, T>()(buffer);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * the test flag must be a valid bool, anything else is rejected
+ *
+ */
+template <typename TB, typename T, typename ...Args>
+struct RawValidator<TB, std::unique_ptr<T, Args...>>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        const auto test_head = buffer;
+        const bool truth = true, falsity = false;
+
+        if (!RawValidator<TB, bool>()(buffer, end, demand))
+        {
+            return false;
+        }
+
+        if (memcmp(test_head, &falsity, sizeof(bool)) == 0)
+        {
+            return true;
+        }
+
+        if (memcmp(test_head, &truth, sizeof(bool)) != 0)
+        {
+            return false;
+        }
+
+        demand += sizeof(T);
+        return RawValidator<TB, T>()(buffer, end, demand);
+    }
+};
+
 } // namespace NAMESPACE
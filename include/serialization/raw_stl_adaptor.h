@@ -92,4 +92,32 @@ struct RawDeserializer<TB, T,
     }
 };
 
+template <typename TB, class T>
+struct RawSkipper<TB, T,
+        enable_if_t< // is_non_default_serializable_adaptor_type
+            !is_serialization_copyable<T>::value &&
+            !is_serialization_copyable_blacklisted<T>::value &&
+            is_adaptor_type<T>::value
+        >>
+{
+    inline TB operator()(TB buffer) const
+    {
+        return RawSkipper<TB, container_type_t<T>>()(buffer);
+    }
+};
+
+template <typename TB, class T>
+struct RawValidator<TB, T,
+        enable_if_t< // is_non_default_serializable_adaptor_type
+            !is_serialization_copyable<T>::value &&
+            !is_serialization_copyable_blacklisted<T>::value &&
+            is_adaptor_type<T>::value
+        >>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        return RawValidator<TB, container_type_t<T>>()(buffer, end, demand);
+    }
+};
+
 } // namespace NAMESPACE
@@ -0,0 +1,251 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+item-wise serialization without containers materialized:
+from iterator ranges and generators, to callbacks
+
+the bytes are identical to the serialization of a container holding the items
+
+*/
+
+#pragma once
+
+#include <cstddef>  // for size_t
+#include <cstring>  // for memcpy
+#include <iterator> // for std::iterator_traits, std::distance
+
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+template <typename TIt>
+using iterator_category_t = typename std::iterator_traits<TIt>::iterator_category;
+
+template <typename TIt>
+using iterator_value_type_t = remove_cv_t<typename std::iterator_traits<TIt>::value_type>;
+
+template <typename TIt, typename Category>
+using is_iterator_of = std::is_base_of<Category, iterator_category_t<TIt>>;
+
+/*
+ * range serializer template class, in the spirit of RawSerializer
+ *
+ */
+template <typename TB, typename TIt, typename Test = void>
+struct RawRangeSerializer
+{
+    static_assert(!is_stream_buffer<TB>::value,
+            "no suitable range serialization found; " \
+            "a stream buffer can not backpatch the size of an input range.");
+};
+
+/*
+ * counted: random access ranges, or forward ranges to stream buffers
+ * the size prefix is written first
+ *
+ */
+template <typename TB, typename TIt>
+struct RawRangeSerializer<TB, TIt,
+        enable_if_t<
+            (is_iterator_of<TIt, std::random_access_iterator_tag>::value ||
+                (is_stream_buffer<TB>::value &&
+                is_iterator_of<TIt, std::forward_iterator_tag>::value)) &&
+            !(std::is_pointer<TIt>::value && !is_stream_buffer<TB>::value &&
+                is_serialization_copyable<iterator_value_type_t<TIt>>::value)
+        >>
+{
+    using TI = iterator_value_type_t<TIt>;
+
+    inline TB operator()(TB buffer, TIt first, TIt last) const
+    {
+        size_t size = size_t(std::distance(first, last));
+
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, size_t>()(buffer, size);
+        for (; first != last; ++first)
+        {
+            buffer = RawSerializationMultiplexer<RawSerializer, TB, const TI>()(buffer, *first);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * counted: copyable items in contiguous memory, one block
+ *
+ */
+template <typename TB, typename TIt>
+struct RawRangeSerializer<TB, TIt,
+        enable_if_t<
+            std::is_pointer<TIt>::value && !is_stream_buffer<TB>::value &&
+            is_serialization_copyable<iterator_value_type_t<TIt>>::value
+        >>
+{
+    using TI = iterator_value_type_t<TIt>;
+
+    inline TB operator()(TB buffer, TIt first, TIt last) const
+    {
+        size_t size = size_t(last - first);
+
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, size_t>()(buffer, size);
+        memcpy(buffer, first, sizeof(TI) * size);
+
+        return buffer + relative_size_of<TI, decltype(*buffer)>::value * size;
+    }
+};
+
+/*
+ * uncounted: input, forward and bidirectional ranges
+ * the size prefix is backpatched, as for std::forward_list
+ *
+ */
+template <typename TB, typename TIt>
+struct RawRangeSerializer<TB, TIt,
+        enable_if_t<
+            !is_iterator_of<TIt, std::random_access_iterator_tag>::value &&
+            !is_stream_buffer<TB>::value
+        >>
+{
+    using TI = iterator_value_type_t<TIt>;
+
+    inline TB operator()(TB buffer, TIt first, TIt last) const
+    {
+        const auto size_head = buffer;
+
+        size_t size = 0;
+
+        buffer += relative_size_of<size_t, decltype(*buffer)>::value;
+        for (; first != last; ++first)
+        {
+            buffer = RawSerializationMultiplexer<RawSerializer, TB, const TI>()(buffer, *first);
+            ++size;
+        }
+        RawSerializationMultiplexer<RawSerializer, TB, size_t>()(size_head, size);
+
+        return buffer;
+    }
+};
+
+/*
+ * serialize [first, last) as a container of its items
+ *
+ */
+template <typename TB, typename TIt>
+inline TB serialize_range(TB buffer, TIt first, TIt last)
+{
+    return RawRangeSerializer<TB, TIt>()(buffer, first, last);
+}
+
+/*
+ * serialized size of [first, last), forward ranges only
+ *
+ */
+template <typename TIt>
+inline auto serialized_range_size(TIt first, TIt last)
+    -> enable_if_t<
+        is_serialization_copyable<iterator_value_type_t<TIt>>::value,
+        decltype(std::declval<const char*>() - std::declval<const char*>())>
+{
+    const auto size = std::distance(first, last);
+
+    return sizeof(size_t) + sizeof(iterator_value_type_t<TIt>) * size;
+}
+
+template <typename TIt>
+inline auto serialized_range_size(TIt first, TIt last)
+    -> enable_if_t<
+        !is_serialization_copyable<iterator_value_type_t<TIt>>::value,
+        decltype(std::declval<const char*>() - std::declval<const char*>())>
+{
+    using TI = iterator_value_type_t<TIt>;
+
+    const char* const buffer = nullptr;
+    auto end = buffer + sizeof(size_t);
+
+    for (; first != last; ++first)
+    {
+        end = RawSerializationMultiplexer<RawDrySerializer, const char*, const TI>()(end, *first);
+    }
+
+    return end - buffer;
+}
+
+/*
+ * serialize the items of a generator as a container of TI
+ *
+ *      bool generator(TI& item)    // fill the next item, false at the end
+ *
+ * the scratch item is reused, the size prefix is backpatched
+ *
+ */
+template <typename TI, typename TB, typename TF>
+inline TB serialize_generated(TB buffer, TF generator)
+{
+    static_assert(!is_stream_buffer<TB>::value,
+            "a stream buffer can not backpatch the size of a generator.");
+
+    const auto size_head = buffer;
+
+    size_t size = 0;
+    TI item;
+
+    buffer += relative_size_of<size_t, decltype(*buffer)>::value;
+    while (generator(item))
+    {
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, TI>()(buffer, item);
+        ++size;
+    }
+    RawSerializationMultiplexer<RawSerializer, TB, size_t>()(size_head, size);
+
+    return buffer;
+}
+
+/*
+ * deserialize into a used object, its capacity is reused when the
+ * deserialization overwrites all of it, otherwise it is cleared first
+ *
+ */
+template <typename TB, typename TO>
+inline auto deserialize_reusing(TB buffer, TO& object)
+    -> enable_if_t<is_deserialization_reusable<TO>::value, TB>
+{
+    return RawSerializationMultiplexer<RawDeserializer, TB, TO>()(buffer, object);
+}
+
+template <typename TB, typename TO>
+inline auto deserialize_reusing(TB buffer, TO& object)
+    -> enable_if_t<!is_deserialization_reusable<TO>::value, TB>
+{
+    return deserialize(buffer, object);
+}
+
+/*
+ * deserialize the items of a serialized container TC one by one to a callback
+ *
+ *      void callback(TI& item)
+ *
+ * consumes the same bytes as deserialize(buffer, TC&) without materializing TC,
+ * the scratch item is reused across items
+ *
+ */
+template <class TC, typename TB, typename TF>
+inline TB deserialize_each(TB buffer, TF callback)
+{
+    using TI = mutable_value_type_t<TC>;
+
+    size_t size;
+    TI item;
+
+    buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+    for (; size > 0; --size)
+    {
+        buffer = deserialize_reusing(buffer, item);
+        callback(item);
+    }
+
+    return buffer;
+}
+
+} // namespace NAMESPACE
@@ -56,4 +56,28 @@ struct RawDeserializer<TB, std::gslice>
     }
 };
 
+template <typename TB>
+struct RawSkipper<TB, std::gslice>
+{
+    inline TB operator()(TB buffer) const
+    {
+        buffer = RawSkipper<TB, size_t>()(buffer);
+        buffer = RawSkipper<TB, std::valarray<size_t>>()(buffer);
+        buffer = RawSkipper<TB, std::valarray<size_t>>()(buffer);
+
+        return buffer;
+    }
+};
+
+template <typename TB>
+struct RawValidator<TB, std::gslice>
+{
+    inline bool operator()(TB& buffer, TB end, size_t& demand) const
+    {
+        return RawValidator<TB, size_t>()(buffer, end, demand) &&
+                RawValidator<TB, std::valarray<size_t>>()(buffer, end, demand) &&
+                RawValidator<TB, std::valarray<size_t>>()(buffer, end, demand);
+    }
+};
+
 } // namespace NAMESPACE
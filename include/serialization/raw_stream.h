@@ -0,0 +1,565 @@
+/*
+
+Copyright (c) 2018 MacroBull
+
+serialization to/from streams, chunked serialization with bounded memory
+
+*/
+
+#pragma once
+
+#include <cstddef>  // for size_t
+#include <cstring>  // for memcpy, memset
+#include <iterator> // for std::distance
+#include <memory>   // for std::unique_ptr
+#include <utility>  // for std::move
+
+#include "raw_stl.h"
+
+namespace NAMESPACE
+{
+
+/*
+ * stream buffer: TB walking a stream instead of a char buffer[]
+ *
+ * TS is the stream policy:
+ *
+ *      void write(const void* data, size_t size)   // serializer
+ *      void read(void* data, size_t size)          // deserializer
+ *
+ * copyable objects and copyable blocks of contiguous containers are passed
+ * to the stream in one call each
+ *
+ * a reader policy may also bound what its input makes the deserializer
+ * allocate (see raw_limits.h):
+ *
+ *      size_t admit(size_t size, size_t item_size) // items to decode, 0 to refuse
+ *      bool enter()                                // one level deeper, false to refuse
+ *      void leave()                                // one level back, after any enter()
+ *
+ */
+template <class TS>
+struct RawStreamBuffer
+{
+    TS* stream;
+};
+
+template <class TS>
+struct is_stream_buffer<RawStreamBuffer<TS>>: std::true_type {};
+
+template <class TS>
+inline RawStreamBuffer<TS> make_stream_buffer(TS& stream)
+{
+    return RawStreamBuffer<TS>{ &stream };
+}
+
+/*
+ * stream policies writing the unordered containers in a canonical order
+ * instead of their iteration order, see raw_canonical.h
+ *
+ */
+template <class TS>
+struct is_canonical_stream: std::false_type {};
+
+TRAITS_DECL_CLASS_HAS_METHOD(admit)
+
+/*
+ * decode-time limit hooks of a reader policy, unlimited by default
+ *
+ */
+template <class TS, typename Test = void>
+struct RawStreamLimits
+{
+    static inline size_t admit(TS& /*stream*/, size_t size, size_t /*item_size*/)
+    {
+        return size;
+    }
+
+    static inline bool enter(TS& /*stream*/)
+    {
+        return true;
+    }
+
+    static inline void leave(TS& /*stream*/)
+    {
+    }
+};
+
+template <class TS>
+struct RawStreamLimits<TS,
+        enable_if_t<
+            has_method_admit<TS, size_t, size_t>::value
+        >>
+{
+    static inline size_t admit(TS& stream, size_t size, size_t item_size)
+    {
+        return stream.admit(size, item_size);
+    }
+
+    static inline bool enter(TS& stream)
+    {
+        return stream.enter();
+    }
+
+    static inline void leave(TS& stream)
+    {
+        stream.leave();
+    }
+};
+
+/*
+ * size of a container without size_t TO.size(), i.e. std::forward_list
+ *
+ */
+template <class T, typename Test = void>
+struct RawContainerSize
+{
+    inline size_t operator()(const T& container) const
+    {
+        return size_t(std::distance(std::begin(container), std::end(container)));
+    }
+};
+
+template <class T>
+struct RawContainerSize<T,
+        enable_if_t<
+            has_method_size_with_ret<T, size_t(void)>::value
+        >>
+{
+    inline size_t operator()(const T& container) const
+    {
+        return container.size();
+    }
+};
+
+/*
+ * serialization-copyable type implementation
+ *
+ */
+template <class TS, typename TO>
+struct RawSerializer<RawStreamBuffer<TS>, TO,
+        enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    using TB = RawStreamBuffer<TS>;
+
+    inline TB operator()(TB buffer, TO& object) const
+    {
+        buffer.stream->write(&object, sizeof(TO));
+        return buffer;
+    }
+};
+
+template <class TS, typename TO>
+struct RawDeserializer<RawStreamBuffer<TS>, TO,
+        enable_if_t<is_serialization_copyable<TO>::value>>
+{
+    using TB = RawStreamBuffer<TS>;
+
+    inline TB operator()(TB buffer, TO& object) const
+    {
+        buffer.stream->read(&object, sizeof(TO));
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::string ...
+ *
+ * contiguous copyable items go as one block
+ *
+ */
+template <class TS, class T>
+struct RawSerializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            is_container_block_copyable<T>::value
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = value_type_t<T>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size = container.size();
+
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, size_t>()(buffer, size);
+        if (size > 0)
+        {
+            buffer.stream->write(&*std::begin(container), sizeof(TI) * size);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::deque<TI, ...>, std::forward_list<TI, ...>, std::list<TI, ...>
+ *      std::set<TI, ...>, std::map<TK, TV, ...> ...
+ *
+ * the size prefix of std::forward_list cannot be backpatched into a stream
+ * position already gone, it is counted ahead instead
+ *
+ */
+template <class TS, class T>
+struct RawSerializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !is_container_block_copyable<T>::value &&
+            !(is_canonical_stream<TS>::value && is_unordered_container_type<T>::value)
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = value_type_t<T>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size = RawContainerSize<T>()(container);
+
+        buffer = RawSerializationMultiplexer<RawSerializer, TB, size_t>()(buffer, size);
+        for (const auto& item: container)
+        {
+            buffer = RawSerializationMultiplexer<RawSerializer, TB, const TI>()(buffer, item);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::vector<TI, ...>, std::string ...
+ *
+ * TO.resize(size_t) and contiguous copyable items, one block
+ *
+ */
+template <class TS, class T>
+struct RawDeserializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value && // restricted to size_t
+            is_container_block_copyable<T>::value
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = value_type_t<T>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+        size = RawStreamLimits<TS>::admit(*buffer.stream, size, sizeof(TI));
+        container.resize(size);
+        if (size > 0)
+        {
+            buffer.stream->read(&*std::begin(container), sizeof(TI) * size);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::deque<TI, ...>, std::forward_list<TI, ...>, std::list<TI, ...> ...
+ *
+ * TO.resize(size_t), item by item
+ *
+ */
+template <class TS, class T>
+struct RawDeserializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value && // restricted to size_t
+            !is_container_block_copyable<T>::value
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = value_type_t<T>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+        size = RawStreamLimits<TS>::enter(*buffer.stream) ?
+                RawStreamLimits<TS>::admit(*buffer.stream, size, sizeof(TI)) : 0;
+        container.resize(size);
+        for (auto& item: container)
+        {
+            buffer = RawSerializationMultiplexer<RawDeserializer, TB, TI>()(buffer, item);
+        }
+        RawStreamLimits<TS>::leave(*buffer.stream);
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::set<TI, ...>, std::map<TK, TV, ...> ...
+ *
+ * standard emplace version, the items can not be inserted from the stream in place
+ *
+ */
+template <class TS, class T>
+struct RawDeserializer<RawStreamBuffer<TS>, T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            !has_method_resize<T, size_t>::value && // restricted to size_t
+            has_method_emplace<T, value_type_t<T>>::value
+        >>
+{
+    using TB = RawStreamBuffer<TS>;
+    using TI = mutable_value_type_t<T>;
+
+    inline TB operator()(TB buffer, T& container) const
+    {
+        size_t size;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, size_t>()(buffer, size);
+        size = RawStreamLimits<TS>::enter(*buffer.stream) ?
+                RawStreamLimits<TS>::admit(*buffer.stream, size, sizeof(TI)) : 0;
+        for (; size > 0; --size)
+        {
+            TI item;
+            buffer = RawSerializationMultiplexer<RawDeserializer, TB, TI>()(buffer, item);
+            container.emplace(std::move(item));
+        }
+        RawStreamLimits<TS>::leave(*buffer.stream);
+
+        return buffer;
+    }
+};
+
+/*
+ * for:
+ *      std::unique_ptr<T, ...>
+ *
+ * the pointee is one level deeper, and one allocation of T
+ *
+ */
+template <class TS, typename T, typename ...Args>
+struct RawDeserializer<RawStreamBuffer<TS>, std::unique_ptr<T, Args...>>
+{
+    using TB = RawStreamBuffer<TS>;
+
+    inline TB operator()(TB buffer, std::unique_ptr<T, Args...>& pointer) const
+    {
+        bool test;
+
+        buffer = RawSerializationMultiplexer<RawDeserializer, TB, bool>()(buffer, test);
+        if (test)
+        {
+            if (RawStreamLimits<TS>::enter(*buffer.stream) &&
+                    RawStreamLimits<TS>::admit(*buffer.stream, 1, sizeof(T)) > 0)
+            {
+                pointer.reset(new T);
+                buffer = RawSerializationMultiplexer<RawDeserializer, TB, T>()(buffer, *pointer);
+            }
+            RawStreamLimits<TS>::leave(*buffer.stream);
+        }
+
+        return buffer;
+    }
+};
+
+/*
+ * chunked writer: stream policy emitting fixed-size chunks to a sink
+ *
+ *      void sink(const char* data, size_t size)
+ *
+ * every chunk but the last one (on flush()) holds exactly chunk_size bytes,
+ * whole chunks of large blocks are passed to the sink without copy
+ *
+ */
+template <typename TF>
+class RawChunkWriter
+{
+public:
+    RawChunkWriter(size_t chunk_size, TF sink):
+        chunk_size_(chunk_size), chunk_(new char[chunk_size]), sink_(std::move(sink)),
+        fill_(0), size_(0)
+    {
+    }
+
+    RawChunkWriter(const RawChunkWriter&) = delete;
+    RawChunkWriter& operator=(const RawChunkWriter&) = delete;
+
+    inline void write(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+
+        size_ += size;
+        while (size > 0)
+        {
+            if (fill_ == 0 && size >= chunk_size_)
+            {
+                sink_(bytes, chunk_size_);
+                bytes += chunk_size_;
+                size -= chunk_size_;
+                continue;
+            }
+
+            const size_t count = size < chunk_size_ - fill_ ? size : chunk_size_ - fill_;
+
+            memcpy(chunk_.get() + fill_, bytes, count);
+            fill_ += count;
+            bytes += count;
+            size -= count;
+
+            if (fill_ == chunk_size_)
+            {
+                sink_(chunk_.get(), fill_);
+                fill_ = 0;
+            }
+        }
+    }
+
+    // emit the last partial chunk
+    inline void flush()
+    {
+        if (fill_ > 0)
+        {
+            sink_(chunk_.get(), fill_);
+            fill_ = 0;
+        }
+    }
+
+    // bytes written so far
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    const size_t chunk_size_;
+    const std::unique_ptr<char[]> chunk_;
+    TF sink_;
+    size_t fill_;
+    size_t size_;
+};
+
+/*
+ * chunked reader: stream policy pulling chunks from a source
+ *
+ *      size_t source(char* data, size_t size)  // bytes read, 0 at the end
+ *
+ * a premature end reads as zeros, which stops all containers, and makes
+ * the reader !good()
+ *
+ */
+template <typename TF>
+class RawChunkReader
+{
+public:
+    RawChunkReader(size_t chunk_size, TF source):
+        chunk_size_(chunk_size), chunk_(new char[chunk_size]), source_(std::move(source)),
+        begin_(0), end_(0), size_(0), good_(true)
+    {
+    }
+
+    RawChunkReader(const RawChunkReader&) = delete;
+    RawChunkReader& operator=(const RawChunkReader&) = delete;
+
+    inline void read(void* data, size_t size)
+    {
+        auto bytes = static_cast<char*>(data);
+
+        while (size > 0)
+        {
+            if (begin_ == end_)
+            {
+                size_t count;
+
+                if (size >= chunk_size_)
+                {
+                    // large blocks skip the chunk
+                    count = good_ ? source_(bytes, size) : 0;
+                    if (count > 0)
+                    {
+                        bytes += count;
+                        size -= count;
+                        size_ += count;
+                        continue;
+                    }
+                }
+                else
+                {
+                    count = good_ ? source_(chunk_.get(), chunk_size_) : 0;
+                    begin_ = 0;
+                    end_ = count;
+                }
+
+                if (count == 0)
+                {
+                    memset(bytes, 0, size);
+                    good_ = false;
+                    return;
+                }
+            }
+
+            const size_t count = size < end_ - begin_ ? size : end_ - begin_;
+
+            memcpy(bytes, chunk_.get() + begin_, count);
+            begin_ += count;
+            bytes += count;
+            size -= count;
+            size_ += count;
+        }
+    }
+
+    // bytes read so far
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    inline bool good() const
+    {
+        return good_;
+    }
+
+private:
+    const size_t chunk_size_;
+    const std::unique_ptr<char[]> chunk_;
+    TF source_;
+    size_t begin_;
+    size_t end_;
+    size_t size_;
+    bool good_;
+};
+
+/*
+ * serialize object as chunk_size chunks to sink, the serialized size
+ * the peak extra memory is one chunk whatever the object size is
+ *
+ */
+template <typename TO, typename TF>
+inline size_t serialize_chunked(const TO& object, size_t chunk_size, TF sink)
+{
+    RawChunkWriter<TF> writer(chunk_size, std::move(sink));
+
+    serialize(make_stream_buffer(writer), object);
+    writer.flush();
+
+    return writer.size();
+}
+
+/*
+ * deserialize object from chunks pulled from source, false on a premature end
+ *
+ */
+template <typename TO, typename TF>
+inline bool deserialize_chunked(TO& object, size_t chunk_size, TF source)
+{
+    RawChunkReader<TF> reader(chunk_size, std::move(source));
+
+    deserialize(make_stream_buffer(reader), object);
+
+    return reader.good();
+}
+
+} // namespace NAMESPACE
@@ -10,6 +10,7 @@ serialization traits for STL types
 
 #include <iterator> // for std::begin, std::end, /*can be lazy included*/
 #include <memory> // for std::unique_ptr
+#include <utility> // for std::pair
 
 #include "traits.h"
 
@@ -88,6 +89,26 @@ struct is_container_type<T,
 template <class T>
 using value_type_t = typename T::value_type;
 
+/*
+ * value_type with the const key of associative containers dropped,
+ * for scratch items to be decoded and moved in: std::pair<const TK, TV> -> std::pair<TK, TV>
+ *
+ */
+template <typename T>
+struct remove_const_key
+{
+    using type = T;
+};
+
+template <typename TK, typename TV>
+struct remove_const_key<std::pair<const TK, TV>>
+{
+    using type = std::pair<TK, TV>;
+};
+
+template <class T>
+using mutable_value_type_t = typename remove_const_key<value_type_t<T>>::type;
+
 /*
 // sequential_type
 template <typename T, typename Test = void>
@@ -249,6 +270,60 @@ struct is_container_batch_insertable<TC, TB,
             is_relative_aligned<value_type_t<TC>, TB>::value
         >>: std::true_type {};
 
+// detail: contiguous storage
+TRAITS_DECL_CLASS_HAS_METHOD(data)
+
+template <typename TC, typename TB = char, typename Test = void>
+struct is_container_block_copyable: std::false_type {};
+
+template <class TC, typename TB>
+struct is_container_block_copyable<TC, TB,
+        enable_if_t<
+            is_container_type<TC>::value &&
+            // TC.data() contiguous
+            has_method_data<TC>::value &&
+            // TI copyable
+            is_serialization_copyable<value_type_t<TC>>::value &&
+            // TI size aligns with TB
+            is_relative_aligned<value_type_t<TC>, TB>::value
+        >>: std::true_type {};
+
+// detail: iteration order
+TRAITS_DECL_CLASS_HAS_TYPE(hasher)
+
+template <class T>
+using is_unordered_container_type = conditional_and_t<
+        is_container_type<T>::value,
+        has_type_hasher<T>::value>;
+
+/*
+ * deserialization into a used object overwrites all of it, its capacity can be reused:
+ *      serialization-copyable types
+ *      std::pair<TK, TV> of such types
+ *      TO.resize(size_t) containers of such items, std::vector<TI, ...>, std::string ...
+ *
+ */
+template <typename T, typename Test = void>
+struct is_deserialization_reusable: is_serialization_copyable<T> {};
+
+template <typename TK, typename TV>
+struct is_deserialization_reusable<std::pair<TK, TV>,
+        enable_if_t<
+            !is_serialization_copyable<std::pair<TK, TV>>::value
+        >>:
+    conditional_and_t<
+        is_deserialization_reusable<remove_const_t<TK>>::value,
+        is_deserialization_reusable<TV>::value
+    > {};
+
+template <class T>
+struct is_deserialization_reusable<T,
+        enable_if_t<
+            is_non_default_serializable_container_type<T>::value &&
+            has_method_resize<T, size_t>::value
+        >>:
+    is_deserialization_reusable<value_type_t<T>> {};
+
 /*
  * @@@ whitelist is_serialization_copyable:
  * fast-forward for KeyValuePair<TK, TV>, std::tuple<...Args>
@@ -0,0 +1,242 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_stl.h"
+#include "serialization/raw_append_log.h"
+#include "serialization/raw_ring.h"
+
+namespace NAMESPACE
+{
+
+TEST(RawSpscRing, Basic)
+{
+    using Type = std::map<int, std::string>;
+
+    RawSpscRing ring(256);
+
+    LOG() << "capacity of RawSpscRing(256) is: " << ring.capacity() << std::endl;
+
+    {
+        Type ti = { { 1, "one" }, { 2, "two" }, { 3, "three" } }, to;
+
+        EXPECT_TRUE(ring.push(ti));
+        EXPECT_TRUE(ring.pop(to));
+        EXPECT_EQ(ti, to);
+        EXPECT_FALSE(ring.pop(to));
+    }
+
+    {
+        RawSpscRing ring(256); // two full size records fill the ring
+        size_t size;
+        const std::string ti(ring.max_size() - sizeof(size_t), 'x');
+        std::string to;
+
+        EXPECT_TRUE(ring.push(ti));
+        EXPECT_TRUE(ring.push(ti));
+        EXPECT_FALSE(ring.push(ti)); // full
+        EXPECT_NE(ring.peek(size), nullptr);
+        EXPECT_EQ(size, serialized_size(ti));
+        ring.release();
+        EXPECT_TRUE(ring.pop(to));
+        EXPECT_EQ(ring.peek(size), nullptr);
+
+        EXPECT_FALSE(ring.push(std::string(ring.max_size(), 'x')));
+        EXPECT_FALSE(ring.pop(to));
+    }
+
+    {
+        RawSpscRing ring(256); // a full size record past the ring head
+        const std::string small = "small";
+        const std::string ti(ring.max_size() - sizeof(size_t), 'x');
+
+        for (size_t offset = 0; offset < ring.capacity() / sizeof(size_t); ++offset)
+        {
+            std::string to;
+
+            EXPECT_TRUE(ring.push(small));
+            EXPECT_TRUE(ring.pop(to));
+            EXPECT_TRUE(ring.push(ti)) << offset;
+            EXPECT_TRUE(ring.pop(to));
+            EXPECT_EQ(to, ti);
+        }
+    }
+}
+
+TEST(RawSpscRing, Wrap)
+{
+    using Type = std::vector<int>;
+
+    RawSpscRing ring(128);
+
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        Type ti(idx % 13, idx), to;
+
+        EXPECT_TRUE(ring.push(ti));
+        EXPECT_TRUE(ring.pop(to));
+        EXPECT_EQ(ti, to);
+    }
+}
+
+TEST(RawSpscRing, Thread)
+{
+    const int n = 1000000;
+    using Type = std::pair<int, std::string>;
+
+    RawSpscRing ring(1 << 16);
+
+    auto t0 = std::chrono::system_clock::now();
+
+    std::thread producer([&]()
+    {
+        for (int idx = 0; idx < n; ++idx)
+        {
+            const Type ti(idx, std::to_string(idx));
+
+            while (!ring.push(ti))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    int mismatch = 0;
+    for (int idx = 0; idx < n; ++idx)
+    {
+        Type to;
+
+        while (!ring.pop(to))
+        {
+            std::this_thread::yield();
+        }
+
+        mismatch += to.first != idx || to.second != std::to_string(idx);
+    }
+
+    producer.join();
+
+    auto t1 = std::chrono::system_clock::now();
+
+    LOG() << n << " records passed in "
+          << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us" << std::endl;
+
+    EXPECT_EQ(mismatch, 0);
+}
+
+TEST(RawAppendLog, Basic)
+{
+    using Type = std::pair<int, std::string>;
+
+    RawAppendLog log(256);
+
+    {
+        Type ti(42, "3.1415"), to;
+
+        EXPECT_FALSE(log.consume(to));
+        EXPECT_TRUE(log.append(ti));
+        EXPECT_TRUE(log.consume(to));
+        EXPECT_EQ(ti, to);
+        EXPECT_FALSE(log.consume(to));
+        EXPECT_FALSE(log.exhausted());
+    }
+
+    {
+        Type to;
+        size_t size;
+        const auto b0 = log.reserve(sizeof(int));
+        const auto b1 = log.reserve(sizeof(int));
+
+        serialize(b1, 1);
+        log.commit(b1, sizeof(int));
+        EXPECT_EQ(log.peek(size), nullptr); // in reservation order
+        serialize(b0, 0);
+        log.commit(b0, sizeof(int));
+        EXPECT_NE(log.peek(size), nullptr);
+        log.release();
+        EXPECT_NE(log.peek(size), nullptr);
+        log.release();
+
+        while (log.append(Type(0, "filling")));
+        while (log.consume(to));
+        EXPECT_TRUE(log.exhausted());
+
+        log.reset();
+        EXPECT_FALSE(log.exhausted());
+        EXPECT_TRUE(log.append(Type(42, "3.1415")));
+        EXPECT_TRUE(log.consume(to));
+        EXPECT_EQ(to.first, 42);
+    }
+}
+
+TEST(RawAppendLog, Thread)
+{
+    const int m = 4;
+    const int n = 100000;
+    using Type = std::pair<int, std::string>;
+
+    RawAppendLog log(size_t(m) * n * 64);
+    std::vector<std::thread> producers;
+
+    auto t0 = std::chrono::system_clock::now();
+
+    for (int idx = 0; idx < m; ++idx)
+    {
+        producers.emplace_back([&log, idx, n]()
+        {
+            for (int jdx = 0; jdx < n; ++jdx)
+            {
+                log.append(Type(idx, std::to_string(jdx)));
+            }
+        });
+    }
+
+    int mismatch = 0;
+    std::vector<int> counts(m, 0);
+    for (int idx = 0; idx < m * n; ++idx)
+    {
+        Type to;
+
+        while (!log.consume(to))
+        {
+            std::this_thread::yield();
+        }
+
+        mismatch += to.second != std::to_string(counts[to.first]++);
+    }
+
+    for (auto& producer: producers)
+    {
+        producer.join();
+    }
+
+    auto t1 = std::chrono::system_clock::now();
+
+    LOG() << m << " x " << n << " records passed in "
+          << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us" << std::endl;
+
+    EXPECT_EQ(mismatch, 0);
+    EXPECT_EQ(counts, std::vector<int>(m, n));
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,206 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <chrono>
+#include <deque>
+#include <forward_list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_coroutine.h"
+#include "serialization/raw_stl.h"
+
+namespace NAMESPACE
+{
+
+// serialize to a flat buffer for reference
+template <typename T>
+std::vector<char> flat(const T& object)
+{
+    std::vector<char> buf(serialized_size(object));
+
+    serialize(buf.data(), object);
+    return buf;
+}
+
+// resume into buffers of capacity bytes until done, the number of resumes
+template <typename T>
+size_t resume_by(const T& object, size_t capacity, size_t item_quota, std::vector<char>& buf)
+{
+    RawIncrementalSerializer<T> serializer(object, item_quota);
+    std::vector<char> chunk(capacity);
+    size_t calls = 0;
+
+    buf.clear();
+    while (!serializer.done())
+    {
+        auto size = serializer.resume(chunk.data(), capacity);
+
+        EXPECT_LT(size, capacity + 1);
+        buf.insert(buf.end(), chunk.data(), chunk.data() + size);
+        ++calls;
+    }
+
+    return calls;
+}
+
+TEST(RawCoroutine, Identical)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::forward_list<int>,
+        std::map<int, std::vector<std::string>>,
+        std::unique_ptr<std::vector<int>>,
+        std::vector<int>,
+        int,
+        std::unordered_map<int, std::string>>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } }, { "zero", {} } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti) = { 2, 7, 1, 8 };
+    std::get<3>(ti) = { { 1, { "x", "yy" } }, { 2, {} }, { 3, { "zzz" } } };
+    std::get<4>(ti).reset(new std::vector<int>(100, 42));
+    std::get<5>(ti).assign(1000, 7);
+    std::get<6>(ti) = 42;
+    std::get<7>(ti) = { { 42, "3.1415" } };
+
+    const auto ref = flat(ti);
+
+    for (size_t capacity: { size_t(1), size_t(7), size_t(64), size_t(1 << 16) })
+    {
+        for (size_t item_quota: { size_t(1), size_t(3), ~size_t(0) })
+        {
+            std::vector<char> buf;
+
+            auto calls = resume_by(ti, capacity, item_quota, buf);
+
+            EXPECT_EQ(buf, ref);
+            EXPECT_GT(calls, (ref.size() - 1) / capacity);
+        }
+    }
+}
+
+TEST(RawCoroutine, Quota)
+{
+    const size_t n = 1000;
+    using Type = std::map<int, std::string>;
+
+    Type ti;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti[int(idx)] = std::to_string(idx);
+    }
+
+    const auto ref = flat(ti);
+    std::vector<char> buf;
+
+    // one more resume to find the end after the last suspension
+    EXPECT_EQ(resume_by(ti, ref.size(), 100, buf), n / 100 + 1);
+    EXPECT_EQ(buf, ref);
+    EXPECT_EQ(resume_by(ti, ref.size() + 1, ~size_t(0), buf), size_t(1));
+    EXPECT_EQ(buf, ref);
+}
+
+TEST(RawCoroutine, Spill)
+{
+    using Type = std::tuple<
+        std::vector<std::string>,
+        std::map<int, std::string>,
+        std::unique_ptr<std::vector<int>>,
+        std::string>;
+
+    // the large items go by pieces, a buffer at a time
+    Type ti;
+
+    std::get<0>(ti) = { "head", std::string(100000, 'x'), "", std::string(1000, 'y'), "tail" };
+    std::get<1>(ti) = { { 1, std::string(10000, 'z') }, { 2, "two" } };
+    std::get<2>(ti).reset(new std::vector<int>(10000, 42));
+    std::get<3>(ti).assign(10000, 'w');
+
+    const auto ref = flat(ti);
+
+    for (size_t capacity: { size_t(1), size_t(64), size_t(4096) })
+    {
+        for (size_t item_quota: { size_t(1), ~size_t(0) })
+        {
+            RawIncrementalSerializer<Type> serializer(ti, item_quota);
+            std::vector<char> chunk(capacity);
+            std::vector<char> buf;
+            size_t max_pending = 0;
+
+            while (!serializer.done())
+            {
+                auto size = serializer.resume(chunk.data(), capacity);
+
+                buf.insert(buf.end(), chunk.data(), chunk.data() + size);
+                max_pending = serializer.pending() > max_pending ?
+                        serializer.pending() : max_pending;
+            }
+
+            EXPECT_EQ(buf, ref);
+            EXPECT_LT(max_pending, sizeof(size_t) + 1) << capacity;
+        }
+    }
+}
+
+TEST(RawCoroutine, MapBench)
+{
+    const size_t n = 1000000;
+    const size_t capacity = 1 << 16;
+    using Type = std::map<int, std::string>;
+
+    Type ti;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.emplace_hint(ti.end(), int(idx), std::to_string(idx));
+    }
+
+    RawIncrementalSerializer<Type> serializer(ti, 10000);
+    std::vector<char> chunk(capacity);
+    double max_pause = 0;
+    size_t size = 0;
+
+    auto t0 = std::chrono::system_clock::now();
+    while (!serializer.done())
+    {
+        auto t1 = std::chrono::system_clock::now();
+
+        size += serializer.resume(chunk.data(), capacity);
+
+        auto t2 = std::chrono::system_clock::now();
+        auto pause = std::chrono::duration<double, std::micro>(t2 - t1).count();
+
+        max_pause = pause > max_pause ? pause : max_pause;
+    }
+    auto t3 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t3 - t0).count()
+          << "us in total, the longest pause " << max_pause << "us" << std::endl;
+
+    EXPECT_EQ(size, size_t(serialized_size(ti)));
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
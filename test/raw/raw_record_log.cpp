@@ -0,0 +1,359 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_record_log.h"
+#include "serialization/raw_recovery.h"
+
+namespace NAMESPACE
+{
+
+using Log = RawRecordLog<int, std::string>;
+
+// a fresh directory for a test
+std::string make_directory(const char* name)
+{
+    const std::string directory = std::string("/tmp/") + name + "_" + std::to_string(getpid());
+
+    mkdir(directory.c_str(), 0755);
+    return directory;
+}
+
+void remove_directory(const std::string& directory)
+{
+    DIR* dir = opendir(directory.c_str());
+
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        unlink((directory + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+// the records from sequence on
+std::map<uint64_t, std::pair<int, std::string>> replay_all(Log& log, uint64_t sequence = 1)
+{
+    std::map<uint64_t, std::pair<int, std::string>> result;
+
+    EXPECT_EQ(log.replay(sequence, [&](uint64_t sequence, const int& key, const std::string& value)
+    {
+        result.emplace(sequence, std::make_pair(key, value));
+    }), 0);
+
+    return result;
+}
+
+TEST(RawRecordLog, AppendRead)
+{
+    const size_t n = 10000;
+    const std::string directory = make_directory("raw_record_log");
+
+    {
+        Log log(directory, 16 << 10, 4 << 10);
+
+        ASSERT_EQ(log.open(), 0);
+        for (size_t idx = 0; idx < n; ++idx)
+        {
+            ASSERT_EQ(log.append(int(idx % 100), std::to_string(idx)), uint64_t(idx + 1));
+        }
+
+        EXPECT_GT(log.segment_count(), size_t(10));
+
+        int key;
+        std::string value;
+
+        for (uint64_t sequence: { uint64_t(1), uint64_t(4242), uint64_t(n) })
+        {
+            ASSERT_EQ(log.read(sequence, key, value), 0);
+            EXPECT_EQ(key, int((sequence - 1) % 100));
+            EXPECT_EQ(value, std::to_string(sequence - 1));
+        }
+
+        EXPECT_EQ(log.read(n + 1, key, value), -1);
+        EXPECT_EQ(errno, ENOENT);
+
+        const auto records = replay_all(log, n - 10);
+
+        ASSERT_EQ(records.size(), size_t(11));
+        EXPECT_EQ(records.begin()->first, uint64_t(n - 10));
+    }
+
+    {
+        Log log(directory, 16 << 10, 4 << 10);
+
+        ASSERT_EQ(log.open(), 0);
+        EXPECT_EQ(log.next_sequence(), uint64_t(n + 1));
+        EXPECT_EQ(replay_all(log).size(), n);
+        EXPECT_EQ(log.append(-1, "reopened"), uint64_t(n + 1));
+    }
+
+    remove_directory(directory);
+}
+
+TEST(RawRecordLog, TornTail)
+{
+    const std::string directory = make_directory("raw_record_log_torn");
+
+    {
+        Log log(directory);
+
+        ASSERT_EQ(log.open(), 0);
+        for (int idx = 0; idx < 100; ++idx)
+        {
+            log.append(idx, std::to_string(idx));
+        }
+    }
+
+    // a record cut short by a crash
+    {
+        const std::string path = directory + "/00000000000000000001.log";
+        struct stat info;
+
+        ASSERT_EQ(stat(path.c_str(), &info), 0);
+        ASSERT_EQ(truncate(path.c_str(), info.st_size - 3), 0);
+    }
+
+    {
+        Log log(directory);
+        int key;
+        std::string value;
+
+        ASSERT_EQ(log.open(), 0);
+        EXPECT_EQ(log.next_sequence(), uint64_t(100));
+        EXPECT_EQ(log.read(99, key, value), 0);
+        EXPECT_EQ(value, "98");
+        EXPECT_EQ(log.append(99, "again"), uint64_t(100));
+        EXPECT_EQ(replay_all(log).size(), size_t(100));
+    }
+
+    remove_directory(directory);
+}
+
+TEST(RawRecordLog, SyncError)
+{
+    const std::string directory = make_directory("raw_record_log_sync");
+    struct rlimit limit;
+
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+    signal(SIGXFSZ, SIG_IGN);
+
+    {
+        Log log(directory, 1 << 20, 100); // synced on each append
+
+        ASSERT_EQ(log.open(), 0);
+
+        struct rlimit low = limit;
+
+        low.rlim_cur = 4096; // the writes fail past it
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &low), 0);
+        for (int idx = 0; idx < 100; ++idx)
+        {
+            EXPECT_EQ(log.append(idx, std::string(100, 'x')), uint64_t(idx + 1));
+        }
+
+        ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+        EXPECT_EQ(log.sync(), -1); // the pending records written, the error reported
+        EXPECT_EQ(errno, EFBIG);
+        EXPECT_EQ(log.append(100, "after"), uint64_t(101));
+        EXPECT_EQ(log.sync(), 0);
+    }
+
+    {
+        Log log(directory);
+
+        ASSERT_EQ(log.open(), 0);
+        EXPECT_EQ(replay_all(log).size(), size_t(101));
+    }
+
+    signal(SIGXFSZ, SIG_DFL);
+    remove_directory(directory);
+}
+
+TEST(RawRecordLog, Compaction)
+{
+    const size_t n = 20000;
+    const int key_count = 50;
+    const std::string directory = make_directory("raw_record_log_compaction");
+
+    std::map<int, std::string> latest;
+
+    {
+        Log log(directory, 32 << 10);
+
+        ASSERT_EQ(log.open(), 0);
+        for (size_t idx = 0; idx < n; ++idx)
+        {
+            const int key = int(idx * 7 % key_count);
+
+            latest[key] = std::to_string(idx);
+            ASSERT_NE(log.append(key, latest[key]), uint64_t(0));
+        }
+
+        const uint64_t size = log.size();
+
+        ASSERT_EQ(log.start_compaction(), 0);
+        for (size_t idx = 0; idx < 100; ++idx) // goes on meanwhile
+        {
+            latest[-1] = std::to_string(idx);
+            ASSERT_NE(log.append(-1, latest[-1]), uint64_t(0));
+        }
+        ASSERT_EQ(log.wait_compaction(), 0);
+
+        LOG() << size << " bytes before compaction, " << log.size() << " after, "
+              << log.segment_count() << " segments" << std::endl;
+        EXPECT_LT(log.size() * 10, size);
+
+        std::map<int, std::string> replayed;
+
+        for (const auto& record: replay_all(log))
+        {
+            replayed[record.second.first] = record.second.second;
+        }
+        EXPECT_EQ(replayed, latest);
+    }
+
+    {
+        Log log(directory, 32 << 10);
+        std::map<int, std::string> replayed;
+
+        ASSERT_EQ(log.open(), 0);
+        EXPECT_EQ(log.next_sequence(), uint64_t(n + 101));
+        for (const auto& record: replay_all(log))
+        {
+            replayed[record.second.first] = record.second.second;
+        }
+        EXPECT_EQ(replayed, latest);
+    }
+
+    remove_directory(directory);
+}
+
+TEST(RawRecordLog, Bench)
+{
+    const size_t n = 100000;
+    const std::string directory = make_directory("raw_record_log_bench");
+    const std::string value(100, 'x');
+
+    {
+        Log log(directory);
+
+        ASSERT_EQ(log.open(), 0);
+
+        auto t0 = std::chrono::system_clock::now();
+        for (size_t idx = 0; idx < n; ++idx)
+        {
+            log.append(int(idx), value);
+        }
+        ASSERT_EQ(log.sync(), 0);
+        auto t1 = std::chrono::system_clock::now();
+
+        LOG() << "+" << std::chrono::duration<double, std::milli>(t1 - t0).count()
+              << "ms for " << n << " records of " << value.size() << " bytes" << std::endl;
+    }
+
+    remove_directory(directory);
+}
+
+TEST(RawRecovery, Parallel)
+{
+    const size_t n = 400000;
+    const size_t key_count = 10000;
+    const size_t partition_count = 64;
+    using Partition = std::unordered_map<int, std::string>;
+    using Recovery = RawRecovery<int, std::string, Partition>;
+
+    const std::string directory = make_directory("raw_recovery");
+    const std::string path = directory + "/checkpoint";
+
+    auto apply = [](Partition& partition, const int& key, const std::string& value)
+    {
+        partition[key] = value;
+    };
+
+    std::vector<Partition> ref(partition_count);
+
+    {
+        Log log(directory, 1 << 20);
+
+        ASSERT_EQ(log.open(), 0);
+        for (size_t idx = 0; idx < n; ++idx)
+        {
+            const int key = int(idx * 7919 % key_count);
+            const std::string value = std::to_string(idx);
+
+            if (idx == n / 4)
+            {
+                ASSERT_EQ(Recovery().checkpoint(path, ref, log.next_sequence()), 0);
+            }
+
+            ASSERT_NE(log.append(key, value), uint64_t(0));
+            apply(ref[Recovery::partition_of(key, partition_count)], key, value);
+        }
+    }
+
+    for (size_t thread_count: { size_t(1), size_t(4) })
+    {
+        Log log(directory, 1 << 20);
+        std::vector<Partition> partitions;
+        std::vector<std::pair<RawRecoveryPhase, size_t>> phases;
+        double elapsed = 0;
+
+        auto hook = [&](RawRecoveryPhase phase, std::chrono::steady_clock::duration duration,
+                size_t count)
+        {
+            phases.emplace_back(phase, count);
+            elapsed += std::chrono::duration<double, std::milli>(duration).count();
+        };
+
+        ASSERT_EQ(log.open(), 0);
+        ASSERT_EQ(Recovery(thread_count).recover(path, log, partitions, apply, hook), 0);
+
+        LOG() << "+" << elapsed << "ms to recover with " << thread_count << " threads" << std::endl;
+
+        EXPECT_EQ(partitions, ref);
+        ASSERT_EQ(phases.size(), size_t(3));
+        EXPECT_EQ(phases[0].first, RawRecoveryPhase::load_checkpoint);
+        EXPECT_EQ(phases[1].second, n - n / 4);
+        EXPECT_EQ(phases[2].second, n - n / 4);
+    }
+
+    {
+        Log log(directory, 1 << 20);
+        std::vector<Partition> partitions(partition_count);
+
+        ASSERT_EQ(log.open(), 0);
+        ASSERT_EQ(Recovery().recover(directory + "/none", log, partitions, apply), 0);
+        EXPECT_EQ(partitions, ref); // the whole log
+    }
+
+    remove_directory(directory);
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,259 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <chrono>
+#include <deque>
+#include <forward_list>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_resumable.h"
+
+namespace NAMESPACE
+{
+
+// feed [buf, buf + size) in chunks of step bytes
+template <typename T>
+size_t feed_by(const char* buf, size_t size, size_t step, T& object)
+{
+    RawResumableDeserializer<T> decoder(object);
+    size_t offset = 0;
+    size_t calls = 0;
+
+    while (!decoder.done() && offset < size)
+    {
+        const size_t count = step < size - offset ? step : size - offset;
+
+        offset += decoder.feed(buf + offset, count);
+        ++calls;
+    }
+
+    EXPECT_TRUE(decoder.done());
+    EXPECT_EQ(offset, size);
+
+    return calls;
+}
+
+TEST(RawResumable, Trivial)
+{
+    using Type = double;
+
+    char buf[sizeof(Type)];
+    Type ti = 3.1415, to = 0;
+
+    serialize(buf, ti);
+
+    RawResumableDeserializer<Type> decoder(to);
+
+    EXPECT_EQ(decoder.demand(), sizeof(Type));
+    EXPECT_EQ(decoder.feed(buf, 3), size_t(3));
+    EXPECT_EQ(decoder.demand(), sizeof(Type) - 3);
+    EXPECT_EQ(decoder.feed(buf + 3, sizeof(Type)), sizeof(Type) - 3);
+    EXPECT_TRUE(decoder.done());
+    EXPECT_EQ(decoder.demand(), size_t(0));
+    EXPECT_EQ(ti, to);
+}
+
+TEST(RawResumable, Vector)
+{
+    const size_t n = 1000;
+    using Type = std::vector<int>;
+
+    const size_t s = sizeof(size_t) + sizeof(int) * n;
+    auto buf = std::unique_ptr<char[]>(new char[s]);
+    Type ti(n);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti[idx] = int(idx);
+    }
+
+    serialize(buf.get(), ti);
+
+    for (size_t step: { size_t(1), size_t(3), size_t(7), size_t(4096) })
+    {
+        Type to;
+
+        feed_by(buf.get(), s, step, to);
+        EXPECT_EQ(ti, to);
+    }
+
+    {
+        Type to;
+        RawResumableDeserializer<Type> decoder(to);
+
+        decoder.feed(buf.get(), 3);
+        EXPECT_EQ(decoder.demand(), sizeof(size_t) - 3); // size prefix
+        decoder.feed(buf.get() + 3, sizeof(size_t) - 3 + 10);
+        EXPECT_EQ(decoder.demand(), sizeof(int) * n - 10); // copyable block
+        EXPECT_EQ(to.size(), n); // partially built
+    }
+}
+
+TEST(RawResumable, Nested)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::list<std::pair<int, std::string>>,
+        std::unique_ptr<std::set<std::string>>,
+        std::unique_ptr<int>,
+        std::unordered_map<int, std::string>>;
+
+    Type ti, to;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } }, { "zero", {} } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti) = { { 1, "one" }, { 2, "two" } };
+    std::get<3>(ti).reset(new std::set<std::string>({ "x", "yy", "zzz" }));
+    std::get<5>(ti) = { { 42, "3.1415" } };
+
+    const size_t s = serialized_size(ti);
+    auto buf = std::unique_ptr<char[]>(new char[s]);
+
+    serialize(buf.get(), ti);
+
+    for (size_t step: { size_t(1), size_t(5), size_t(64), s })
+    {
+        std::get<4>(to).reset(new int(7));
+
+        auto calls = feed_by(buf.get(), s, step, to);
+
+        LOG() << "decoded " << s << " bytes in " << calls << " feeds" << std::endl;
+
+        EXPECT_EQ(std::get<0>(ti), std::get<0>(to));
+        EXPECT_EQ(std::get<1>(ti), std::get<1>(to));
+        EXPECT_EQ(std::get<2>(ti), std::get<2>(to));
+        ASSERT_NE(std::get<3>(to), nullptr);
+        EXPECT_EQ(*std::get<3>(ti), *std::get<3>(to));
+        EXPECT_EQ(std::get<4>(to), nullptr);
+        EXPECT_EQ(std::get<5>(ti), std::get<5>(to));
+    }
+}
+
+// resume into buffers of capacity bytes until done, the number of resumes
+template <typename T>
+size_t resume_by(const T& object, size_t capacity, RawTimeBudget::clock::duration budget,
+        std::vector<char>& buf)
+{
+    RawResumableSerializer<T> serializer(object);
+    std::vector<char> chunk(capacity);
+    size_t calls = 0;
+
+    buf.clear();
+    while (!serializer.done())
+    {
+        auto size = serializer.resume(chunk.data(), capacity, budget);
+
+        buf.insert(buf.end(), chunk.data(), chunk.data() + size);
+        ++calls;
+    }
+
+    return calls;
+}
+
+TEST(RawResumableEncoder, Identical)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::forward_list<int>,
+        std::list<std::pair<int, std::string>>,
+        std::unique_ptr<std::set<std::string>>,
+        std::unique_ptr<int>,
+        std::vector<int>,
+        std::unordered_map<int, std::string>>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } }, { "zero", {} } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti) = { 2, 7, 1, 8 };
+    std::get<3>(ti) = { { 1, "one" }, { 2, "two" } };
+    std::get<4>(ti).reset(new std::set<std::string>({ "x", "yy", "zzz" }));
+    std::get<6>(ti).assign(1000, 42);
+    std::get<7>(ti) = { { 42, "3.1415" } };
+
+    const size_t s = serialized_size(ti);
+    std::vector<char> ref(s);
+
+    serialize(ref.data(), ti);
+
+    for (size_t capacity: { size_t(1), size_t(5), size_t(64), s })
+    {
+        std::vector<char> buf;
+
+        auto calls = resume_by(ti, capacity, std::chrono::seconds(1), buf);
+
+        EXPECT_EQ(calls, (s - 1) / capacity + 1);
+        EXPECT_EQ(buf, ref);
+
+        resume_by(ti, capacity, std::chrono::seconds(0), buf);
+        EXPECT_EQ(buf, ref);
+    }
+}
+
+TEST(RawResumableEncoder, Budget)
+{
+    const size_t n = 1000000;
+    const auto budget = std::chrono::microseconds(500);
+    using Type = std::map<int, std::vector<std::string>>;
+
+    Type ti;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti[int(idx / 4)].push_back(std::to_string(idx));
+    }
+
+    const size_t s = serialized_size(ti);
+    auto buf = std::unique_ptr<char[]>(new char[s]);
+    RawResumableSerializer<Type> serializer(ti);
+    size_t offset = 0;
+    size_t calls = 0;
+    double max_call = 0;
+
+    while (!serializer.done())
+    {
+        auto t0 = std::chrono::steady_clock::now();
+
+        offset += serializer.resume(buf.get() + offset, s - offset, budget);
+
+        auto t1 = std::chrono::steady_clock::now();
+        auto call = std::chrono::duration<double, std::micro>(t1 - t0).count();
+
+        max_call = call > max_call ? call : max_call;
+        ++calls;
+    }
+
+    LOG() << "serialized " << s << " bytes in " << calls << " calls, the longest "
+          << max_call << "us" << std::endl;
+
+    std::unique_ptr<char[]> ref(new char[s]);
+
+    serialize(ref.get(), ti);
+    EXPECT_EQ(offset, s);
+    EXPECT_EQ(memcmp(buf.get(), ref.get(), s), 0);
+    EXPECT_GT(calls, size_t(1));
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
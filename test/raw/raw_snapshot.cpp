@@ -0,0 +1,364 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_checkpoint.h"
+#include "serialization/raw_chunk_store.h"
+#include "serialization/raw_snapshot.h"
+#include "serialization/raw_stl.h"
+
+namespace NAMESPACE
+{
+
+// the content of a file
+std::vector<char> slurp(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    return std::vector<char>(std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>());
+}
+
+TEST(RawSnapshot, Fork)
+{
+    const size_t n = 1000000;
+    using Type = std::map<int, std::string>;
+
+    const std::string path = "/tmp/raw_snapshot_" + std::to_string(getpid());
+    Type ti, to;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.emplace_hint(ti.end(), int(idx), std::to_string(idx));
+    }
+
+    const Type ref = ti;
+    RawSnapshot snapshot;
+
+    auto t0 = std::chrono::system_clock::now();
+    ASSERT_EQ(snapshot.start(ti, path), 0);
+    auto t1 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us to fork" << std::endl;
+
+    EXPECT_TRUE(snapshot.running());
+    EXPECT_EQ(snapshot.start(ti, path), -1);
+    EXPECT_EQ(errno, EBUSY);
+
+    // the parent goes on, the child sees the state at start()
+    ti.clear();
+    ti[-1] = "modified";
+
+    pollfd event = { snapshot.fd(), POLLIN, 0 };
+
+    EXPECT_EQ(poll(&event, 1, 60000), 1);
+    EXPECT_EQ(snapshot.wait(), 0);
+    EXPECT_FALSE(snapshot.running());
+
+    const auto buf = slurp(path);
+
+    ASSERT_EQ(buf.size(), size_t(serialized_size(ref)));
+    deserialize(buf.data(), to);
+    EXPECT_EQ(to, ref);
+
+    unlink(path.c_str());
+}
+
+TEST(RawSnapshot, Error)
+{
+    const std::vector<int> ti(100, 42);
+    RawSnapshot snapshot;
+
+    ASSERT_EQ(snapshot.start(ti, "/nonexistent/raw_snapshot"), 0);
+    EXPECT_EQ(snapshot.wait(), -1);
+    EXPECT_EQ(errno, ENOENT);
+
+    // an exception in the child, from its chunk allocation
+    const std::string path = "/tmp/raw_snapshot_throw_" + std::to_string(getpid());
+
+    ASSERT_EQ(snapshot.start(ti, path, size_t(-1) / 2), 0);
+    EXPECT_EQ(snapshot.wait(), -1);
+    EXPECT_EQ(errno, EIO);
+    EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+
+    // renamed onto a directory, the temporary file goes
+    ASSERT_EQ(mkdir(path.c_str(), 0755), 0);
+    ASSERT_EQ(snapshot.start(ti, path), 0);
+    EXPECT_EQ(snapshot.wait(), -1);
+    EXPECT_EQ(errno, EISDIR);
+    EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+    rmdir(path.c_str());
+}
+
+// the size of a file
+size_t file_size(const std::string& path)
+{
+    struct stat info;
+
+    return stat(path.c_str(), &info) < 0 ? 0 : size_t(info.st_size);
+}
+
+TEST(RawCheckpoint, Incremental)
+{
+    const size_t n = 100000;
+
+    const std::string prefix = "/tmp/raw_checkpoint_" + std::to_string(getpid());
+    RawTrackedVector<double> vi(1024);
+    RawTrackedMap<int, std::string> mi(256);
+    RawCheckpointStore store(prefix);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        vi.push_back(double(idx));
+        mi[int(idx)] = std::to_string(idx);
+    }
+
+    ASSERT_EQ(store.checkpoint(false, vi, mi), 0); // the base
+    EXPECT_TRUE(std::get<2>(vi.delta()).empty());
+    EXPECT_TRUE(std::get<1>(mi.delta()).empty());
+
+    const size_t base_size = file_size(store.files()[0]);
+
+    vi[42] = -1;
+    vi.resize(n + 10);
+    mi[42] = "forty-two";
+    mi.erase(7);
+    ASSERT_EQ(store.checkpoint(false, vi, mi), 0);
+
+    vi[n / 2] = -2;
+    mi[-1] = "minus one";
+    ASSERT_EQ(store.checkpoint(false, vi, mi), 0);
+    ASSERT_EQ(store.files().size(), size_t(3));
+
+    const size_t delta_size = file_size(store.files()[2]);
+
+    LOG() << "base " << base_size << " bytes, delta " << delta_size << " bytes" << std::endl;
+    EXPECT_LT(delta_size * 20, base_size);
+
+    {
+        RawTrackedVector<double> vo(1024);
+        RawTrackedMap<int, std::string> mo(256);
+        RawCheckpointStore restored(prefix);
+
+        ASSERT_EQ(restored.restore(vo, mo), 0);
+        EXPECT_EQ(vo.items(), vi.items());
+        EXPECT_EQ(mo.partitions(), mi.partitions());
+        EXPECT_EQ(mo.find(7), nullptr);
+        ASSERT_NE(mo.find(42), nullptr);
+        EXPECT_EQ(*mo.find(42), "forty-two");
+    }
+
+    {
+        RawTrackedVector<double> vo(1024);
+        RawTrackedMap<int, std::string> mo(128); // other partitions
+
+        EXPECT_EQ(RawCheckpointStore(prefix).restore(vo, mo), -1);
+        EXPECT_EQ(errno, EBADMSG);
+    }
+
+    {
+        RawTrackedVector<double> vo(512); // other chunks
+        RawTrackedMap<int, std::string> mo(256);
+
+        EXPECT_EQ(RawCheckpointStore(prefix).restore(vo, mo), -1);
+        EXPECT_EQ(errno, EBADMSG);
+    }
+
+    {
+        RawTrackedVector<double> vo(1024);
+        auto delta = vi.delta(true);
+
+        std::get<1>(delta) = 1000; // the last chunk runs past the size
+        EXPECT_FALSE(vo.apply(delta));
+        EXPECT_EQ(vo.size(), size_t(0));
+    }
+
+    ASSERT_EQ(store.checkpoint(true, vi, mi), 0); // rebase, the deltas go
+    ASSERT_EQ(store.files().size(), size_t(1));
+    EXPECT_EQ(file_size(prefix + ".1"), size_t(0));
+
+    {
+        RawTrackedVector<double> vo(1024);
+        RawTrackedMap<int, std::string> mo(256);
+        RawCheckpointStore restored(prefix);
+
+        ASSERT_EQ(restored.restore(vo, mo), 0);
+        EXPECT_EQ(vo.items(), vi.items());
+        EXPECT_EQ(mo.partitions(), mi.partitions());
+    }
+
+    // a new store over the files of the previous one, without restore()
+    {
+        RawCheckpointStore again(prefix);
+        const auto files = store.files();
+
+        vi[0] = -3;
+        ASSERT_EQ(again.checkpoint(false, vi, mi), 0); // a base of its own
+        ASSERT_EQ(again.files().size(), size_t(1));
+        EXPECT_NE(again.files()[0], files[0]);
+        EXPECT_EQ(file_size(files[0]), size_t(0));
+
+        RawTrackedVector<double> vo(1024);
+        RawTrackedMap<int, std::string> mo(256);
+
+        ASSERT_EQ(RawCheckpointStore(prefix).restore(vo, mo), 0);
+        EXPECT_EQ(vo.items(), vi.items());
+        EXPECT_EQ(mo.partitions(), mi.partitions());
+
+        for (const auto& file: again.files())
+        {
+            unlink(file.c_str());
+        }
+    }
+
+    unlink((prefix + ".manifest").c_str());
+}
+
+// the hex string of digest
+std::string hex(const RawChunkId& digest)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+
+    for (auto byte: digest)
+    {
+        result += digits[byte >> 4];
+        result += digits[byte & 0xf];
+    }
+
+    return result;
+}
+
+TEST(RawChunkStore, Sha256)
+{
+    const std::string abc = "abc";
+    const std::string two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+    EXPECT_EQ(hex(RawSha256::hash("", 0)),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(hex(RawSha256::hash(abc.data(), abc.size())),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(hex(RawSha256::hash(two_blocks.data(), two_blocks.size())),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    RawSha256 sha; // by pieces
+
+    for (size_t idx = 0; idx < 1000000; idx += 1000)
+    {
+        const std::string piece(1000, 'a');
+
+        sha.update(piece.data(), piece.size());
+    }
+    EXPECT_EQ(hex(sha.digest()),
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST(RawChunkStore, Dedup)
+{
+    const size_t n = 1000000;
+    using Type = std::map<int, std::string>;
+
+    const std::string directory = "/tmp/raw_chunk_store_" + std::to_string(getpid());
+    Type ti, to;
+
+    ASSERT_EQ(mkdir(directory.c_str(), 0755), 0);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.emplace_hint(ti.end(), int(idx), std::to_string(idx));
+    }
+
+    {
+        RawChunkStore store(directory);
+        const size_t full_size = serialized_size(ti);
+
+        auto t0 = std::chrono::system_clock::now();
+        ASSERT_EQ(store.save("first", ti), 0);
+        auto t1 = std::chrono::system_clock::now();
+
+        const size_t first_size = store.stored_size();
+
+        // shifts all the bytes after each change
+        ti[42] = "forty-two";
+        ti[n / 2] = "half";
+        ti.erase(int(n - 10));
+
+        auto t2 = std::chrono::system_clock::now();
+        ASSERT_EQ(store.save("second", ti), 0);
+        auto t3 = std::chrono::system_clock::now();
+
+        const size_t second_size = store.stored_size() - first_size;
+
+        LOG() << "+" << std::chrono::duration<double, std::milli>(t1 - t0).count()
+              << "ms, " << first_size << " bytes for the first snapshot, +"
+              << std::chrono::duration<double, std::milli>(t3 - t2).count()
+              << "ms, " << second_size << " bytes for the second" << std::endl;
+
+        EXPECT_EQ(first_size, full_size);
+        EXPECT_LT(second_size * 50, first_size);
+    }
+
+    {
+        RawChunkStore store(directory); // a fresh one dedups against the files
+
+        ASSERT_EQ(store.load("second", to), 0);
+        EXPECT_EQ(to, ti);
+        ASSERT_EQ(store.save("third", to), 0);
+        EXPECT_EQ(store.stored_size(), size_t(0));
+    }
+
+    {
+        RawChunkStore store(directory);
+        std::pair<size_t, std::vector<RawChunkId>> manifest;
+        std::vector<char> buf;
+
+        // a manifest claiming more than its chunks hold
+        ASSERT_EQ(read_file(directory + "/second.manifest", buf), 0);
+        deserialize(static_cast<const char*>(buf.data()), manifest);
+        manifest.first = size_t(-1) / 2;
+        buf.resize(serialized_size(manifest));
+        serialize(buf.data(), manifest);
+        ASSERT_EQ(write_file_atomic(directory + "/forged.manifest", buf.data(), buf.size()), 0);
+
+        EXPECT_EQ(store.get("forged", buf), -1);
+        EXPECT_EQ(errno, EBADMSG);
+    }
+
+    DIR* dir = opendir(directory.c_str());
+
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        unlink((directory + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
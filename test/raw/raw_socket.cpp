@@ -0,0 +1,246 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_stl.h"
+#include "serialization/raw_frame.h"
+#include "serialization/raw_memfd.h"
+
+namespace NAMESPACE
+{
+
+TEST(RawFrame, Reassembly)
+{
+    using Type = std::map<int, std::string>;
+
+    std::vector<char> stream;
+
+    {
+        int fds[2];
+
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+        {
+            RawFrameWriter writer(fds[0], 1 << 20, std::chrono::hours(1));
+
+            EXPECT_TRUE(writer.write(1, Type{ { 1, "one" }, { 2, "two" } }));
+            EXPECT_TRUE(writer.write(2, std::string(10000, 'x')));
+            EXPECT_TRUE(writer.write(3, 42));
+            EXPECT_GT(writer.pending(), size_t(10000));
+        }
+
+        close(fds[0]);
+
+        char buf[4096];
+        ssize_t count;
+        while ((count = read(fds[1], buf, sizeof(buf))) > 0)
+        {
+            stream.insert(stream.end(), buf, buf + count);
+        }
+
+        close(fds[1]);
+    }
+
+    {
+        RawFrameReader reader;
+        uint32_t type;
+        size_t idx = 0;
+        Type to1;
+        std::string to2;
+        int to3;
+
+        // one byte at a time
+        for (; !reader.read(type, to1); ++idx)
+        {
+            reader.feed(&stream[idx], 1);
+        }
+        EXPECT_EQ(type, uint32_t(1));
+        EXPECT_EQ(to1.at(2), "two");
+
+        for (; !reader.read(type, to2); ++idx)
+        {
+            reader.feed(&stream[idx], 1);
+        }
+        EXPECT_EQ(type, uint32_t(2));
+        EXPECT_EQ(to2, std::string(10000, 'x'));
+
+        reader.feed(&stream[idx], stream.size() - idx);
+        EXPECT_TRUE(reader.read(type, to3));
+        EXPECT_EQ(type, uint32_t(3));
+        EXPECT_EQ(to3, 42);
+        EXPECT_FALSE(reader.read(type, to3));
+    }
+
+    {
+        RawFrameReader reader(-1, 16);
+        uint32_t type;
+        std::string to;
+
+        reader.feed(stream.data(), stream.size());
+        EXPECT_FALSE(reader.read(type, to));
+        EXPECT_TRUE(reader.bad());
+    }
+}
+
+TEST(RawFrame, SocketPair)
+{
+    const int n = 1000000;
+    using Type = std::pair<int, float>;
+
+    int fds[2];
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    auto t0 = std::chrono::system_clock::now();
+
+    std::thread producer([&]()
+    {
+        RawFrameWriter writer(fds[0]);
+
+        for (int idx = 0; idx < n; ++idx)
+        {
+            writer.write(uint32_t(idx & 0xff), Type(idx, idx * .5f));
+        }
+    });
+
+    RawFrameReader reader(fds[1]);
+    int mismatch = 0;
+    int received = 0;
+    while (received < n && reader.fill() > 0)
+    {
+        uint32_t type;
+        Type to;
+
+        while (reader.read(type, to))
+        {
+            mismatch += to.first != received || type != uint32_t(received & 0xff);
+            ++received;
+        }
+    }
+
+    producer.join();
+    close(fds[0]);
+    close(fds[1]);
+
+    auto t1 = std::chrono::system_clock::now();
+
+    LOG() << n << " frames passed in "
+          << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us" << std::endl;
+
+    EXPECT_EQ(received, n);
+    EXPECT_EQ(mismatch, 0);
+}
+
+TEST(RawMemfd, SocketPair)
+{
+    const size_t n = 1000000;
+    using Type = std::vector<std::string>;
+
+    int fds[2];
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    {
+        Type ti(n), to;
+
+        for (size_t idx = 0; idx < n; ++idx)
+        {
+            ti[idx] = std::to_string(idx);
+        }
+
+        auto t0 = std::chrono::system_clock::now();
+        auto ret = send_memfd(fds[0], ti);
+        auto t1 = std::chrono::system_clock::now();
+
+        RawMemfdMapping mapping;
+
+        EXPECT_EQ(ret, 0);
+        EXPECT_EQ(recv_memfd(fds[1], mapping), 0);
+        EXPECT_EQ(mapping.size(), size_t(serialized_size(ti)));
+
+        auto t2 = std::chrono::system_clock::now();
+        auto po = deserialize(mapping.data(), to);
+        auto t3 = std::chrono::system_clock::now();
+
+        LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+              << "us +" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+              << "us +" << std::chrono::duration<double, std::micro>(t3 - t2).count()
+              << "us" << std::endl;
+
+        EXPECT_EQ(po, mapping.data() + mapping.size());
+        EXPECT_EQ(ti, to);
+    }
+
+    {
+        std::map<int, std::string> ti = { { 1, "one" } }, to;
+
+        EXPECT_EQ(send_memfd(fds[0], ti), 0);
+        EXPECT_EQ(recv_memfd(fds[1], to), 0);
+        EXPECT_EQ(ti, to);
+    }
+
+    close(fds[0]);
+
+    {
+        RawMemfdMapping mapping;
+
+        EXPECT_EQ(recv_memfd(fds[1], mapping), -1);
+        EXPECT_FALSE(mapping);
+    }
+
+    close(fds[1]);
+}
+
+TEST(RawMemfd, Unsealed)
+{
+    auto file = tmpfile();
+    const std::string data(100, 'x');
+
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(write(fileno(file), data.data(), data.size()), ssize_t(data.size()));
+
+    {
+        RawMemfdMapping mapping;
+
+        EXPECT_FALSE(mapping.map(dup(fileno(file)), data.size())); // regular file
+        EXPECT_EQ(mapping.data(), nullptr);
+    }
+
+    {
+        RawMemfdMapping mapping;
+        const int fd = memfd_create("raw_memfd_unsealed", MFD_ALLOW_SEALING);
+
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(write(fd, data.data(), data.size()), ssize_t(data.size()));
+        EXPECT_FALSE(mapping.map(fd, data.size()));
+        EXPECT_EQ(errno, EPERM);
+    }
+
+    fclose(file);
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
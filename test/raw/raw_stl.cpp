@@ -10,11 +10,15 @@ Copyleft 2018 Macrobull
 #include <deque>
 #include <forward_list>
 #include <initializer_list>
+#include <iterator>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
+#include <sstream>
 #include <stack>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <valarray>
@@ -24,9 +28,11 @@ Copyleft 2018 Macrobull
 
 #include "test.h"
 
+#include "serialization/raw_diff.h"
 #include "serialization/raw_stl.h"
 #include "serialization/raw_stl_adaptor.h"
 #include "serialization/raw_stl_initializer_list.h"
+#include "serialization/raw_stl_iterator.h"
 #include "serialization/raw_stl_valarray.h"
 
 namespace NAMESPACE
@@ -1666,6 +1672,485 @@ TEST(RawStlManaged, UniquePtr)
     }
 }
 
+TEST(RawStlIterator, Range)
+{
+    using ValueType = std::string;
+    using Type = std::vector<ValueType>;
+
+    const Type ti = { "apple", "banana", "coconut", "durian" };
+    const Type sub(ti.begin() + 1, ti.end() - 1);
+    const size_t s = serialized_size(sub);
+
+    {
+        char buf[s], ref[s];
+        Type to;
+
+        auto pi = serialize_range(buf, ti.begin() + 1, ti.end() - 1);
+        serialize(ref, sub);
+        auto po = deserialize(buf, to);
+
+        EXPECT_EQ(pi, po);
+        EXPECT_EQ(memcmp(buf, ref, s), 0);
+        EXPECT_EQ(sub, to);
+
+        auto size = serialized_range_size(ti.begin() + 1, ti.end() - 1);
+
+        EXPECT_EQ(size, sizeof(buf));
+    }
+
+    {
+        const std::list<ValueType> li(sub.begin(), sub.end());
+        char buf[s];
+        Type to;
+
+        auto pi = serialize_range(buf, li.begin(), li.end()); // backpatched
+        auto po = deserialize(buf, to);
+
+        EXPECT_EQ(pi, po);
+        EXPECT_EQ(sub, to);
+    }
+}
+
+TEST(RawStlIterator, RangeFastCopy)
+{
+    using ValueType = int;
+    using Type = std::vector<ValueType>;
+
+    const ValueType array[] = { 3, 1, 4, 1, 5, 9, 2, 6 };
+    const size_t s = sizeof(size_t) + sizeof(array);
+
+    {
+        char buf[s];
+        Type to;
+
+        auto pi = serialize_range(buf, std::begin(array), std::end(array));
+        auto po = deserialize(buf, to);
+
+        EXPECT_EQ(pi, po);
+        EXPECT_EQ(Type(std::begin(array), std::end(array)), to);
+
+        auto size = serialized_range_size(std::begin(array), std::end(array));
+
+        EXPECT_EQ(size, sizeof(buf));
+    }
+
+    {
+        std::istringstream stream("2 7 1 8 2 8");
+        char buf[s];
+        Type to;
+
+        auto pi = serialize_range(buf, // input range, backpatched
+                std::istream_iterator<ValueType>(stream), std::istream_iterator<ValueType>());
+        auto po = deserialize(buf, to);
+
+        EXPECT_EQ(pi, po);
+        EXPECT_EQ(Type({ 2, 7, 1, 8, 2, 8 }), to);
+    }
+}
+
+TEST(RawStlIterator, Generator)
+{
+    using ValueType = std::string;
+    using Type = std::set<ValueType>;
+
+    const Type ref = { "0", "1", "2", "3", "4" };
+    const size_t s = serialized_size(ref);
+
+    {
+        char buf[s], cbuf[s];
+        Type to;
+        int idx = 0;
+
+        auto pi = serialize_generated<ValueType>(buf, [&idx](ValueType& item)
+        {
+            item = std::to_string(idx);
+            return idx++ < 5;
+        });
+        serialize(cbuf, ref);
+        auto po = deserialize(buf, to);
+
+        EXPECT_EQ(pi, po);
+        EXPECT_EQ(memcmp(buf, cbuf, s), 0);
+        EXPECT_EQ(ref, to);
+    }
+}
+
+TEST(RawStlIterator, Each)
+{
+    using ValueType = std::pair<int, std::string>;
+    using Type = std::vector<ValueType>;
+
+    const Type ti = { { 4, "four" }, { 3, "six" }, { 2, "" }, { 1, "I" } };
+    const size_t s = serialized_size(ti);
+
+    {
+        char buf[s];
+        int sum = 0;
+        std::string concat;
+        const char* data = nullptr;
+        bool reused = true;
+
+        serialize(buf, ti);
+        auto po = deserialize_each<Type>(buf, [&](ValueType& item)
+        {
+            sum += item.first;
+            concat += item.second;
+            reused = reused && (data == nullptr || data == item.second.data());
+            data = item.second.data();
+        });
+
+        EXPECT_EQ(po, buf + s);
+        EXPECT_EQ(sum, 10);
+        EXPECT_EQ(concat, "foursixI");
+        EXPECT_TRUE(reused); // shrinking strings keep their storage
+    }
+}
+
+TEST(RawStlIterator, EachAssociative)
+{
+    using Type = std::map<std::string, std::set<int>>;
+
+    const Type ti = { { "a", { 1, 2, 3 } }, { "b", { 4 } }, { "c", {} } };
+    const size_t s = serialized_size(ti);
+
+    {
+        char buf[s];
+        Type to;
+
+        serialize(buf, ti);
+        auto po = deserialize_each<Type>(buf, [&](std::pair<std::string, std::set<int>>& item)
+        {
+            to.emplace(item); // the set is cleared between items
+        });
+
+        EXPECT_EQ(po, buf + s);
+        EXPECT_EQ(ti, to);
+    }
+}
+
+TEST(RawStlSkip, Field)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::unique_ptr<std::list<int>>,
+        std::stack<std::string>,
+        int>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti).reset(new std::list<int>({ 2, 7, 1, 8 }));
+    std::get<3>(ti).push("top");
+    std::get<4>(ti) = 42;
+
+    const size_t s = serialized_size(ti);
+
+    {
+        char buf[s];
+
+        serialize(buf, ti);
+
+        const char* po = buf;
+
+        po = skip<std::map<std::string, std::vector<float>>>(po);
+        EXPECT_EQ(po, buf + serialized_size(std::get<0>(ti)));
+        po = skip<std::deque<std::string>>(po);
+        po = skip<std::unique_ptr<std::list<int>>>(po);
+        po = skip<std::stack<std::string>>(po);
+
+        int to = 0;
+
+        po = deserialize(po, to); // the last field only
+        EXPECT_EQ(po, buf + s);
+        EXPECT_EQ(to, 42);
+        EXPECT_EQ(skip<Type>(static_cast<const char*>(buf)), buf + s);
+    }
+}
+
+TEST(RawStlSkip, Bench)
+{
+    const size_t n = 1000000;
+    using Type = std::pair<std::vector<std::string>, int>;
+
+    Type ti;
+
+    ti.first.resize(n);
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.first[idx] = std::to_string(idx);
+    }
+    ti.second = 42;
+
+    const size_t s = serialized_size(ti);
+    auto buf = std::unique_ptr<char[]>(new char[s]);
+
+    serialize(buf.get(), ti);
+
+    {
+        Type to;
+
+        auto t0 = std::chrono::system_clock::now();
+        auto po = deserialize(static_cast<const char*>(buf.get()), to);
+        auto t1 = std::chrono::system_clock::now();
+
+        LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+              << "us to deserialize" << std::endl;
+        EXPECT_EQ(po, buf.get() + s);
+    }
+
+    {
+        int to = 0;
+
+        auto t0 = std::chrono::system_clock::now();
+        auto po = skip<std::vector<std::string>>(static_cast<const char*>(buf.get()));
+        po = deserialize(po, to);
+        auto t1 = std::chrono::system_clock::now();
+
+        LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+              << "us to skip" << std::endl;
+        EXPECT_EQ(po, buf.get() + s);
+        EXPECT_EQ(to, 42);
+    }
+}
+
+TEST(RawStlValidate, Valid)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::unique_ptr<std::vector<int>>,
+        std::unique_ptr<int>,
+        std::stack<std::string>>;
+
+    Type ti, to;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti).reset(new std::vector<int>(100, 42));
+    std::get<3>(ti).push("top");
+
+    const size_t s = serialized_size(ti);
+
+    {
+        char buf[s];
+        const char* const end = buf + s;
+        size_t demand;
+
+        serialize(buf, ti);
+        EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end, demand), end);
+        LOG() << "demand = " << demand << std::endl;
+        EXPECT_GE(demand, sizeof(std::vector<int>) + sizeof(int) * 100);
+
+        deserialize(static_cast<const char*>(buf), to); // validated
+        EXPECT_EQ(std::get<0>(ti), std::get<0>(to));
+        ASSERT_NE(std::get<1>(to), nullptr);
+        EXPECT_EQ(*std::get<1>(ti), *std::get<1>(to));
+        EXPECT_EQ(std::get<2>(to), nullptr);
+        EXPECT_EQ(std::get<3>(ti), std::get<3>(to));
+
+        for (size_t size = 0; size < s; ++size) // every truncation
+        {
+            EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end - (s - size)), nullptr);
+        }
+    }
+
+    {
+        using Type = std::vector<int>;
+
+        const Type ti(10, 42);
+        char buf[sizeof(size_t) + sizeof(int) * 10];
+        const char* const end = buf + sizeof(buf);
+        size_t demand;
+
+        serialize(buf, ti);
+        EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end, demand), end);
+        EXPECT_EQ(demand, sizeof(int) * 10);
+    }
+}
+
+TEST(RawStlValidate, Malformed)
+{
+    using Type = std::vector<std::pair<std::unique_ptr<int>, std::string>>;
+
+    Type ti(3);
+
+    ti[0].first.reset(new int(42));
+    ti[1].second = "apple";
+
+    const size_t s = serialized_size(ti);
+
+    {
+        char buf[s];
+        const char* const end = buf + s;
+
+        serialize(buf, ti);
+        EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end), end);
+
+        buf[sizeof(size_t)] = 2; // bad test flag
+        EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end), nullptr);
+        buf[sizeof(size_t)] = 1;
+
+        const size_t huge = ~size_t(0) / 2;
+
+        memcpy(buf, &huge, sizeof(size_t)); // bad size prefix, rejected at once
+        EXPECT_EQ(validate<Type>(static_cast<const char*>(buf), end), nullptr);
+        EXPECT_EQ(validate<std::vector<int>>(static_cast<const char*>(buf), end), nullptr);
+    }
+}
+
+TEST(RawStlDiff, Structural)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::unordered_map<int, std::string>,
+        std::set<int>,
+        std::vector<int>,
+        std::string,
+        int>;
+
+    Type ti, to;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } }, { "zero", {} } };
+    std::get<1>(ti) = { { 1, "apple" }, { 2, "banana" } };
+    std::get<2>(ti) = { 2, 7, 1, 8 };
+    std::get<3>(ti).assign(1000, 7);
+    std::get<4>(ti) = "3.1415";
+    std::get<5>(ti) = 42;
+
+    to = ti;
+
+    {
+        raw_patch_t<Type> patch;
+
+        EXPECT_FALSE(RawDiffer<Type>()(ti, to, patch));
+    }
+
+    std::get<0>(to)["three"][1] = -2.f;
+    std::get<0>(to)["four"] = { 4.f };
+    std::get<0>(to).erase("zero");
+    std::get<1>(to)[2] = "cherry";
+    std::get<1>(to).erase(1);
+    std::get<2>(to).erase(7);
+    std::get<2>(to).insert(3);
+    std::get<3>(to)[10] = 0;
+    std::get<3>(to)[12] = 0;
+    std::get<3>(to)[500] = 0;
+    std::get<3>(to).resize(1003, 9);
+    std::get<4>(to) = "2.71828";
+    std::get<5>(to) = -1;
+
+    const auto patch = diff(ti, to);
+    const auto& ranges = std::get<2>(std::get<3>(patch));
+
+    ASSERT_EQ(ranges.size(), size_t(3));
+    EXPECT_EQ(ranges[0].first, size_t(10));
+    EXPECT_EQ(ranges[0].second.size(), size_t(3)); // merged over the gap
+    EXPECT_EQ(ranges[2].first, size_t(1000));
+    EXPECT_EQ(std::get<2>(std::get<0>(patch)), std::vector<std::string>{ "zero" });
+
+    // through the serializer, as shipped to a follower
+    const size_t s = serialized_size(patch);
+    std::vector<char> buf(s);
+    raw_patch_t<Type> po;
+
+    EXPECT_EQ(serialize(buf.data(), patch), buf.data() + s);
+    EXPECT_EQ(deserialize(buf.data(), po), buf.data() + s);
+
+    Type follower = ti;
+
+    EXPECT_TRUE(apply_patch(po, follower));
+    EXPECT_EQ(follower, to);
+
+    // a diverged follower
+    std::get<1>(follower).erase(2);
+    EXPECT_FALSE(apply_patch(po, follower));
+
+    follower = ti;
+    std::get<3>(follower).pop_back();
+    EXPECT_FALSE(apply_patch(po, follower));
+}
+
+TEST(RawStlDiff, MoveOnly)
+{
+    using Type = std::tuple<std::string, std::unique_ptr<int>>;
+
+    Type ti("one", std::unique_ptr<int>(new int(1)));
+    Type to("one", std::unique_ptr<int>(new int(2)));
+
+    const auto patch = diff(ti, to);
+
+    EXPECT_TRUE(std::get<2>(std::get<0>(patch)).empty());
+    ASSERT_NE(std::get<1>(patch), nullptr);
+    EXPECT_TRUE(apply_patch(patch, ti));
+    ASSERT_NE(std::get<1>(ti), nullptr);
+    EXPECT_EQ(*std::get<1>(ti), 2);
+    EXPECT_NE(std::get<1>(ti), std::get<1>(to)); // a copy
+
+    // equal pointees at other addresses
+    using Nested = std::tuple<
+        std::vector<std::unique_ptr<int>>,
+        std::map<int, std::unique_ptr<std::string>>,
+        std::unique_ptr<int>>;
+
+    Nested ni, no;
+
+    for (auto object: { &ni, &no })
+    {
+        std::get<0>(*object).emplace_back(new int(1));
+        std::get<0>(*object).emplace_back();
+        std::get<1>(*object)[1].reset(new std::string("one"));
+        std::get<1>(*object)[2];
+    }
+
+    raw_patch_t<Nested> np;
+
+    EXPECT_FALSE(RawDiffer<Nested>()(ni, no, np));
+
+    *std::get<0>(no)[0] = 2;
+    std::get<0>(no).emplace_back(new int(3));
+    std::get<1>(no)[3].reset(new std::string("three"));
+    std::get<2>(no).reset(new int(4));
+    EXPECT_TRUE(RawDiffer<Nested>()(ni, no, np));
+    EXPECT_TRUE(apply_patch(np, ni));
+    EXPECT_FALSE(RawDiffer<Nested>()(ni, no, np));
+}
+
+TEST(RawStlDiff, Compact)
+{
+    const size_t n = 100000;
+    using Type = std::map<int, std::string>;
+
+    Type ti;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.emplace_hint(ti.end(), int(idx), std::to_string(idx));
+    }
+
+    Type to = ti;
+
+    for (size_t idx = 0; idx < n; idx += 1000) // 0.1%
+    {
+        to[int(idx)] = "changed";
+    }
+    to.erase(1);
+    to[-1] = "inserted";
+
+    auto t0 = std::chrono::system_clock::now();
+    const auto patch = diff(ti, to);
+    auto t1 = std::chrono::system_clock::now();
+
+    const size_t full_size = serialized_size(to);
+    const size_t patch_size = serialized_size(patch);
+
+    LOG() << "+" << std::chrono::duration<double, std::milli>(t1 - t0).count()
+          << "ms to diff, " << patch_size << " of " << full_size << " bytes" << std::endl;
+    EXPECT_LT(patch_size * 100, full_size);
+
+    EXPECT_TRUE(apply_patch(patch, ti));
+    EXPECT_EQ(ti, to);
+}
+
 } // namespace NAMESPACE
 
 int main(int argc, char* argv[])
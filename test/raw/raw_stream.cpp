@@ -0,0 +1,875 @@
+/*
+
+Copyleft 2018 Macrobull
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <forward_list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "test.h"
+
+#include "serialization/raw_canonical.h"
+#include "serialization/raw_checksum.h"
+#include "serialization/raw_hash.h"
+#include "serialization/raw_limits.h"
+#include "serialization/raw_pipeline.h"
+#include "serialization/raw_pool.h"
+#include "serialization/raw_rope.h"
+#include "serialization/raw_stl.h"
+#include "serialization/raw_stream.h"
+
+namespace NAMESPACE
+{
+
+// serialize to a flat buffer for reference
+template <typename T>
+std::vector<char> flat(const T& object)
+{
+    std::vector<char> buf(serialized_size(object));
+
+    serialize(buf.data(), object);
+    return buf;
+}
+
+TEST(RawStreamChunked, Identical)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::forward_list<int>,
+        std::set<int>,
+        std::unique_ptr<std::vector<int>>,
+        std::unordered_map<int, std::string>>;
+
+    Type ti, to;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } }, { "zero", {} } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti) = { 2, 7, 1, 8 };
+    std::get<3>(ti) = { 3, 1, 4, 1, 5, 9, 2, 6 };
+    std::get<4>(ti).reset(new std::vector<int>(1000, 42));
+    std::get<5>(ti) = { { 42, "3.1415" } };
+
+    const auto ref = flat(ti);
+
+    for (size_t chunk_size: { size_t(1), size_t(7), size_t(64), size_t(4096) })
+    {
+        std::vector<char> buf;
+        size_t max_size = 0;
+
+        auto size = serialize_chunked(ti, chunk_size, [&](const char* data, size_t size)
+        {
+            EXPECT_TRUE(size == chunk_size || buf.size() + size == ref.size());
+            max_size = size > max_size ? size : max_size;
+            buf.insert(buf.end(), data, data + size);
+        });
+
+        EXPECT_EQ(size, ref.size());
+        EXPECT_EQ(max_size, chunk_size < ref.size() ? chunk_size : ref.size());
+        EXPECT_EQ(buf, ref);
+
+        size_t offset = 0;
+        auto good = deserialize_chunked(to, chunk_size, [&](char* data, size_t size)
+        {
+            size = size < buf.size() - offset ? size : buf.size() - offset;
+            memcpy(data, buf.data() + offset, size);
+            offset += size;
+            return size;
+        });
+
+        EXPECT_TRUE(good);
+        EXPECT_EQ(offset, buf.size());
+        EXPECT_EQ(std::get<0>(ti), std::get<0>(to));
+        EXPECT_EQ(std::get<1>(ti), std::get<1>(to));
+        EXPECT_EQ(std::get<2>(ti), std::get<2>(to));
+        EXPECT_EQ(std::get<3>(ti), std::get<3>(to));
+        ASSERT_NE(std::get<4>(to), nullptr);
+        EXPECT_EQ(*std::get<4>(ti), *std::get<4>(to));
+        EXPECT_EQ(std::get<5>(ti), std::get<5>(to));
+    }
+}
+
+TEST(RawStreamChunked, Truncated)
+{
+    using Type = std::vector<std::string>;
+
+    const Type ti = { "apple", "banana", "coconut" };
+    const auto ref = flat(ti);
+    Type to;
+
+    size_t offset = 0;
+    auto good = deserialize_chunked(to, 4, [&](char* data, size_t size)
+    {
+        size = size < ref.size() / 2 - offset ? size : ref.size() / 2 - offset;
+        memcpy(data, ref.data() + offset, size);
+        offset += size;
+        return size;
+    });
+
+    EXPECT_FALSE(good);
+    EXPECT_LT(to.size(), ti.size() + 1);
+}
+
+TEST(RawStreamChunked, VectorStringBench)
+{
+    const size_t n = 10000000;
+    const size_t chunk_size = 1 << 16;
+    using Type = std::vector<std::string>;
+
+    Type ti(n);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti[idx] = std::to_string(idx);
+    }
+
+    size_t count = 0;
+    size_t sum = 0;
+
+    auto t0 = std::chrono::system_clock::now();
+    auto size = serialize_chunked(ti, chunk_size, [&](const char* data, size_t size)
+    {
+        ++count;
+        sum += size_t(data[size - 1]);
+    });
+    auto t1 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us for " << count << " chunks" << std::endl;
+
+    EXPECT_EQ(size, size_t(serialized_size(ti)));
+    EXPECT_EQ(count, (size - 1) / chunk_size + 1);
+}
+
+TEST(RawStreamLimits, Valid)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::unique_ptr<std::vector<int>>,
+        std::unique_ptr<int>,
+        std::set<int>>;
+
+    Type ti, to;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti).reset(new std::vector<int>(100, 42));
+    std::get<3>(ti) = { 3, 1, 4 };
+
+    const auto ref = flat(ti);
+    const RawDecodeLimits limits = { 1 << 20, 1000, 4 };
+
+    auto po = deserialize_limited(ref.data(), ref.size(), to, limits);
+
+    EXPECT_EQ(po, ref.data() + ref.size());
+    EXPECT_EQ(std::get<0>(ti), std::get<0>(to));
+    ASSERT_NE(std::get<1>(to), nullptr);
+    EXPECT_EQ(*std::get<1>(ti), *std::get<1>(to));
+    EXPECT_EQ(std::get<2>(to), nullptr);
+    EXPECT_EQ(std::get<3>(ti), std::get<3>(to));
+
+    EXPECT_EQ(deserialize_limited(ref.data(), ref.size() - 1, to, limits), nullptr);
+}
+
+TEST(RawStreamLimits, ForgedSize)
+{
+    using Type = std::vector<std::string>;
+
+    const Type ti = { "apple", "banana", "coconut" };
+    auto ref = flat(ti);
+    const RawDecodeLimits limits = { 1 << 20, 1000, 4 };
+
+    const size_t huge = size_t(1) << 40;
+    Type to;
+
+    memcpy(ref.data(), &huge, sizeof(size_t)); // forged outer size
+    EXPECT_EQ(deserialize_limited(ref.data(), ref.size(), to, limits), nullptr);
+    EXPECT_TRUE(to.empty());
+
+    ref = flat(ti);
+    memcpy(ref.data() + sizeof(size_t), &huge, sizeof(size_t)); // forged item size
+    EXPECT_EQ(deserialize_limited(ref.data(), ref.size(), to, limits), nullptr);
+    EXPECT_LT(to.size(), ti.size() + 1);
+    EXPECT_TRUE(to[0].empty());
+
+    const RawDecodeLimits tight = { 16, 1000, 4 }; // 3 std::string exceed 16 bytes
+
+    ref = flat(ti);
+    EXPECT_EQ(deserialize_limited(ref.data(), ref.size(), to, tight), nullptr);
+    EXPECT_TRUE(to.empty());
+}
+
+TEST(RawStreamLimits, Depth)
+{
+    using Type = std::unique_ptr<std::vector<std::unique_ptr<std::deque<int>>>>;
+
+    Type ti(new std::vector<std::unique_ptr<std::deque<int>>>(2));
+
+    (*ti)[1].reset(new std::deque<int>({ 1, 2, 3 }));
+
+    const auto ref = flat(ti);
+
+    for (size_t depth = 0; depth < 6; ++depth)
+    {
+        const RawDecodeLimits limits = { 1 << 20, 1000, depth };
+        Type to;
+
+        auto po = deserialize_limited(ref.data(), ref.size(), to, limits);
+
+        EXPECT_EQ(po != nullptr, depth >= 4);
+        if (po != nullptr)
+        {
+            ASSERT_NE(to, nullptr);
+            ASSERT_NE((*to)[1], nullptr);
+            EXPECT_EQ(*(*ti)[1], *(*to)[1]);
+        }
+    }
+}
+
+TEST(RawStreamRope, Identical)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::vector<int>>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti).assign(1000, 42);
+
+    const auto ref = flat(ti);
+
+    for (size_t block_size: { size_t(1), size_t(7), size_t(64), size_t(4096) })
+    {
+        RawBlockPool pool(block_size);
+        std::vector<char> buf;
+
+        for (int round = 0; round < 2; ++round) // the blocks are recycled
+        {
+            RawRopeWriter rope(pool);
+
+            serialize(make_stream_buffer(rope), ti);
+            EXPECT_EQ(rope.size(), ref.size());
+
+            const auto segments = rope.iovecs();
+
+            EXPECT_EQ(segments.size(), (ref.size() - 1) / block_size + 1);
+            buf.clear();
+            for (const auto& segment: segments)
+            {
+                EXPECT_LT(segment.iov_len, block_size + 1);
+                buf.insert(buf.end(), static_cast<const char*>(segment.iov_base),
+                        static_cast<const char*>(segment.iov_base) + segment.iov_len);
+            }
+            EXPECT_EQ(buf, ref);
+        }
+
+        EXPECT_EQ(pool.idle(), (ref.size() - 1) / block_size + 1);
+    }
+}
+
+TEST(RawStreamRope, Writev)
+{
+    using Type = std::vector<std::string>;
+
+    Type ti(100000), to;
+
+    for (size_t idx = 0; idx < ti.size(); ++idx)
+    {
+        ti[idx] = std::to_string(idx);
+    }
+
+    RawBlockPool pool(256); // more segments than IOV_MAX
+    RawRopeWriter rope(pool);
+
+    serialize(make_stream_buffer(rope), ti);
+
+    auto file = tmpfile();
+
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(write_rope(fileno(file), rope), ssize_t(rope.size()));
+
+    std::vector<char> buf(rope.size());
+
+    EXPECT_EQ(pread(fileno(file), buf.data(), buf.size(), 0), ssize_t(buf.size()));
+    fclose(file);
+
+    deserialize(static_cast<const char*>(buf.data()), to);
+    EXPECT_EQ(ti, to);
+
+    // a non-blocking pipe takes a part at a time, resumed from the offset
+    int fds[2];
+
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+    buf.clear();
+    for (size_t offset = 0; offset < rope.size(); )
+    {
+        const ssize_t count = write_rope(fds[1], rope, offset);
+
+        if (count < 0)
+        {
+            ASSERT_EQ(errno, EAGAIN);
+        }
+        else
+        {
+            EXPECT_GT(count, 0);
+            offset += size_t(count);
+        }
+
+        char piece[4096];
+        ssize_t size;
+
+        while ((size = read(fds[0], piece, sizeof(piece))) > 0)
+        {
+            buf.insert(buf.end(), piece, piece + size);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    EXPECT_EQ(buf.size(), rope.size());
+    to.clear();
+    deserialize(static_cast<const char*>(buf.data()), to);
+    EXPECT_EQ(ti, to);
+}
+
+TEST(RawStreamPooled, Estimate)
+{
+    using Type = std::vector<std::string>;
+
+    Type ti = { "apple", "banana", "coconut" }, to;
+
+    for (size_t n: { size_t(3), size_t(300), size_t(30), size_t(3000) })
+    {
+        ti.resize(n, "durian");
+
+        const auto ref = flat(ti);
+        const auto estimate = RawSizeEstimate<Type>::get();
+        auto buf = serialize_pooled(ti);
+
+        EXPECT_EQ(buf.size(), ref.size());
+        EXPECT_LT(buf.size(), buf.capacity() + 1);
+        EXPECT_EQ(std::vector<char>(buf.data(), buf.data() + buf.size()), ref);
+        EXPECT_GT(RawSizeEstimate<Type>::get(), estimate < ref.size() ? ref.size() - 1 : 0);
+
+        deserialize(static_cast<const char*>(buf.data()), to);
+        EXPECT_EQ(ti, to);
+    }
+
+    auto& pool = RawBufferPool::local();
+    const auto idle = pool.idle();
+
+    {
+        auto buf = serialize_pooled(ti);
+        auto moved = std::move(buf);
+
+        EXPECT_EQ(buf.data(), nullptr);
+        EXPECT_EQ(pool.idle(), idle - 1); // one reused
+    }
+    EXPECT_EQ(pool.idle(), idle);
+}
+
+TEST(RawStreamPooled, ThreadExit)
+{
+    RawPooledBuffer buf;
+
+    // destroyed at the exit of its thread, after the pool of the thread
+    std::thread([&]()
+    {
+        static thread_local RawPooledBuffer late;
+
+        late = RawBufferPool::local().acquire(1000);
+        buf = RawBufferPool::local().acquire(1000);
+        EXPECT_NE(late.data(), nullptr);
+    }).join();
+
+    // destroyed on a thread without a pool
+    std::thread([&]()
+    {
+        EXPECT_EQ(RawBufferPool::current(), nullptr);
+        RawPooledBuffer(std::move(buf));
+        EXPECT_EQ(RawBufferPool::current(), nullptr);
+    }).join();
+
+    EXPECT_EQ(buf.data(), nullptr);
+}
+
+TEST(RawStreamPooled, Bench)
+{
+    const size_t n = 100000;
+    using Type = std::vector<std::string>;
+
+    Type ti(100);
+    size_t sum = 0;
+
+    for (size_t idx = 0; idx < ti.size(); ++idx)
+    {
+        ti[idx] = std::to_string(idx);
+    }
+
+    auto t0 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        std::unique_ptr<char[]> buf(new char[serialized_size(ti)]);
+
+        serialize(buf.get(), ti);
+        sum += size_t(buf[idx % 64]);
+    }
+    auto t1 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        auto buf = serialize_pooled(ti);
+
+        sum -= size_t(buf.data()[idx % 64]);
+    }
+    auto t2 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us with new buffers, "
+          << "+" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+          << "us with pooled buffers" << std::endl;
+
+    EXPECT_EQ(sum, size_t(0));
+}
+
+TEST(RawStreamPipelined, Identical)
+{
+    using Type = std::tuple<
+        std::map<std::string, std::vector<float>>,
+        std::deque<std::string>,
+        std::vector<int>>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti) = { "apple", "", "banana" };
+    std::get<2>(ti).assign(100000, 42); // spans many buffers
+
+    const auto ref = flat(ti);
+
+    for (size_t buffer_count: { size_t(2), size_t(3), size_t(8) })
+    {
+        for (size_t buffer_size: { size_t(1), size_t(7), size_t(4096) })
+        {
+            std::vector<char> buf;
+
+            auto size = serialize_pipelined(ti, buffer_size, buffer_count,
+                    [&](const char* data, size_t size)
+            {
+                EXPECT_TRUE(size == buffer_size || buf.size() + size == ref.size());
+                buf.insert(buf.end(), data, data + size);
+            });
+
+            EXPECT_EQ(size, ref.size());
+            EXPECT_EQ(buf, ref);
+        }
+    }
+}
+
+TEST(RawStreamPipelined, Bench)
+{
+    const size_t n = 2000000;
+    const size_t buffer_size = 1 << 16;
+    using Type = std::vector<std::string>;
+
+    Type ti(n);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti[idx] = std::to_string(idx);
+    }
+
+    auto file = tmpfile();
+
+    ASSERT_NE(file, nullptr);
+
+    const auto sink = [&](const char* data, size_t size)
+    {
+        EXPECT_EQ(write(fileno(file), data, size), ssize_t(size));
+    };
+
+    auto t0 = std::chrono::system_clock::now();
+    auto size_chunked = serialize_chunked(ti, buffer_size, sink);
+    auto t1 = std::chrono::system_clock::now();
+    auto size_pipelined = serialize_pipelined(ti, buffer_size, 2, sink);
+    auto t2 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us chunked, "
+          << "+" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+          << "us pipelined" << std::endl;
+
+    EXPECT_EQ(size_chunked, size_pipelined);
+    fclose(file);
+}
+
+TEST(RawStreamChecksum, Crc32c)
+{
+    const std::string check = "123456789";
+    std::string text(10000, '\0');
+
+    for (size_t idx = 0; idx < text.size(); ++idx)
+    {
+        text[idx] = char(idx * 7919 >> 3);
+    }
+
+    EXPECT_EQ(crc32c_portable(check.data(), check.size()), 0xe3069283u);
+    EXPECT_EQ(crc32c(check.data(), check.size()), 0xe3069283u);
+    EXPECT_EQ(crc32c(text.data() + 333, text.size() - 333, crc32c(text.data(), 333)),
+            crc32c(text.data(), text.size()));
+#ifdef RAW_CRC32C_HARDWARE
+    if (has_crc32c_hardware())
+    {
+        EXPECT_EQ(crc32c_hardware(check.data(), check.size()), 0xe3069283u);
+        for (size_t offset: { size_t(0), size_t(1), size_t(5) })
+        {
+            for (size_t size: { size_t(0), size_t(7), size_t(3071), size_t(3072),
+                    size_t(3080), size_t(6150), size_t(9000) })
+            {
+                EXPECT_EQ(crc32c_hardware(text.data() + offset, size, 42),
+                        crc32c_portable(text.data() + offset, size, 42)) << offset << " " << size;
+            }
+        }
+    }
+#endif
+}
+
+TEST(RawStreamChecksum, XxHash64)
+{
+    const std::string text = "Nobody inspects the spammish repetition";
+
+    auto hash = [](const std::string& text, uint64_t seed)
+    {
+        RawXxHash64 checksum(seed);
+
+        checksum.update(text.data(), text.size());
+        return checksum.value();
+    };
+
+    EXPECT_EQ(hash("", 0), 0xef46db3751d8e999ull);
+    EXPECT_EQ(hash("a", 0), 0xd24ec4f1a98c6e5bull);
+    EXPECT_EQ(hash("abc", 0), 0x44bc2cf5ad770999ull);
+    EXPECT_EQ(hash(text, 0), 0xfbcea83c8a378bf1ull);
+
+    const std::string long_text = text + text + text;
+
+    for (size_t split = 0; split <= long_text.size(); ++split)
+    {
+        RawXxHash64 checksum(42);
+
+        checksum.update(long_text.data(), split);
+        checksum.update(long_text.data() + split, long_text.size() - split);
+        EXPECT_EQ(checksum.value(), hash(long_text, 42)) << split;
+    }
+}
+
+TEST(RawStreamChecksum, Fused)
+{
+    using Type = std::tuple<std::map<std::string, std::vector<float>>, std::vector<int>>;
+
+    Type ti;
+
+    std::get<0>(ti) = { { "one", { 1.f } }, { "three", { 1.f, 2.f, 3.f } } };
+    std::get<1>(ti).assign(10000, 42);
+
+    const auto ref = flat(ti);
+    std::vector<char> buf(ref.size());
+
+    {
+        RawCrc32c checksum;
+        RawXxHash64 hash;
+
+        EXPECT_EQ(serialize_checksummed(buf.data(), buf.size(), ti, checksum), ref.size());
+        EXPECT_EQ(buf, ref);
+        EXPECT_EQ(checksum.value(), crc32c(ref.data(), ref.size()));
+
+        serialize_checksummed(buf.data(), buf.size(), ti, hash);
+
+        RawXxHash64 separate;
+
+        separate.update(ref.data(), ref.size());
+        EXPECT_EQ(hash.value(), separate.value());
+    }
+
+    {
+        RawCrc32c checksum;
+        Type to;
+
+        EXPECT_EQ(deserialize_checksummed(buf.data(), buf.size(), to, checksum),
+                buf.data() + buf.size());
+        EXPECT_EQ(to, ti);
+        EXPECT_EQ(checksum.value(), crc32c(ref.data(), ref.size()));
+    }
+
+    {
+        RawCrc32c checksum;
+        Type to;
+
+        buf[buf.size() / 2] ^= 1; // flipped in place, still well-formed
+        EXPECT_NE(deserialize_checksummed(buf.data(), buf.size(), to, checksum), nullptr);
+        EXPECT_NE(checksum.value(), crc32c(ref.data(), ref.size()));
+    }
+
+    {
+        RawCrc32c checksum;
+        Type to;
+
+        EXPECT_EQ(deserialize_checksummed(buf.data(), buf.size() - 1, to, checksum), nullptr);
+    }
+}
+
+TEST(RawStreamChecksum, Bench)
+{
+    const size_t n = 1000;
+    using Type = std::vector<std::string>;
+
+    Type ti(1000);
+
+    for (size_t idx = 0; idx < ti.size(); ++idx)
+    {
+        ti[idx] = std::string(idx % 200, char(idx));
+    }
+
+    std::vector<char> buf(serialized_size(ti));
+    uint32_t sum = crc32c(buf.data(), serialize(buf.data(), ti) - buf.data()); // warm up
+
+    sum ^= crc32c(buf.data(), buf.size());
+
+    auto t0 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        serialize(buf.data(), ti);
+        sum ^= crc32c(buf.data(), buf.size());
+    }
+    auto t1 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        RawCrc32c checksum;
+
+        serialize_checksummed(buf.data(), buf.size(), ti, checksum);
+        sum ^= checksum.value();
+    }
+    auto t2 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        sum ^= crc32c_portable(buf.data(), buf.size());
+    }
+    auto t3 = std::chrono::system_clock::now();
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        sum ^= crc32c(buf.data(), buf.size());
+    }
+    auto t4 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us with a separate pass, "
+          << "+" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+          << "us fused, for " << n << " x " << buf.size() << " bytes" << std::endl;
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t3 - t2).count()
+          << "us portable CRC32C, "
+          << "+" << std::chrono::duration<double, std::micro>(t4 - t3).count()
+          << "us dispatched CRC32C" << std::endl;
+
+    EXPECT_EQ(sum, 0u); // an even count of each
+}
+
+TEST(RawStreamHash, Identical)
+{
+    using Type = std::tuple<std::string, int, std::vector<uint32_t>, std::map<int, std::string>>;
+
+    Type ti("key", 42, std::vector<uint32_t>(1000, 7), { { 1, "one" }, { 2, "two" } });
+
+    const auto ref = flat(ti);
+
+    for (uint64_t seed: { uint64_t(0), uint64_t(42) })
+    {
+        RawXxHash64 checksum(seed);
+
+        checksum.update(ref.data(), ref.size());
+        EXPECT_EQ(structural_hash(ti, seed), checksum.value());
+    }
+
+    Type to = ti;
+
+    EXPECT_EQ(RawHash<Type>()(to), RawHash<Type>()(ti));
+    std::get<2>(to)[500] = 8;
+    EXPECT_NE(RawHash<Type>()(to), RawHash<Type>()(ti));
+}
+
+TEST(RawStreamHash, Bench)
+{
+    const size_t n = 100000;
+    using Key = std::tuple<std::string, int, std::vector<uint32_t>>;
+
+    std::vector<Key> keys(n);
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        keys[idx] = Key("key " + std::to_string(idx), int(idx), std::vector<uint32_t>(idx % 16, 7));
+    }
+
+    // hashed through a temporary buffer for reference
+    struct BufferHash
+    {
+        inline size_t operator()(const Key& key) const
+        {
+            RawXxHash64 checksum;
+            const auto buf = flat(key);
+
+            checksum.update(buf.data(), buf.size());
+            return size_t(checksum.value());
+        }
+    };
+
+    size_t sum_buffer = 0;
+    size_t sum_structural = 0;
+
+    auto t0 = std::chrono::system_clock::now();
+    for (const auto& key: keys)
+    {
+        sum_buffer += BufferHash()(key);
+    }
+    auto t1 = std::chrono::system_clock::now();
+    for (const auto& key: keys)
+    {
+        sum_structural += RawHash<Key>()(key);
+    }
+    auto t2 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us hashing through buffers, "
+          << "+" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+          << "us hashing structurally" << std::endl;
+
+    EXPECT_EQ(sum_structural, sum_buffer);
+
+    std::unordered_map<Key, size_t, RawHash<Key>> map;
+
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        map.emplace(keys[idx], idx);
+    }
+
+    ASSERT_EQ(map.size(), n);
+    for (size_t idx = 0; idx < n; idx += 997)
+    {
+        EXPECT_EQ(map.at(keys[idx]), idx);
+    }
+}
+
+TEST(RawStreamCanonical, Identical)
+{
+    using Type = std::tuple<
+        std::unordered_map<std::string, std::unordered_set<int>>,
+        std::unordered_multimap<int, std::string>,
+        std::vector<int>>;
+
+    Type ti;
+    Type tj;
+
+    std::get<1>(tj).reserve(1000); // other buckets
+    for (int idx = 0; idx < 100; ++idx)
+    {
+        std::get<0>(ti)[std::to_string(idx)].insert({ idx, idx * 2, idx * 3 });
+        std::get<1>(ti).emplace(idx % 10, std::to_string(idx));
+    }
+    for (int idx = 99; idx >= 0; --idx)
+    {
+        auto& set = std::get<0>(tj)[std::to_string(idx)];
+
+        set.reserve(100);
+        set.insert({ idx * 3, idx * 2, idx });
+        std::get<1>(tj).emplace(idx % 10, std::to_string(idx));
+    }
+    std::get<2>(ti) = std::get<2>(tj) = { 1, 2, 3 };
+
+    ASSERT_EQ(ti, tj);
+    LOG() << "serialized " << (flat(ti) == flat(tj) ? "equal" : "different")
+          << " in iteration order" << std::endl;
+
+    const auto bytes = serialize_canonical(ti);
+
+    EXPECT_EQ(bytes.size(), serialized_size(ti));
+    EXPECT_EQ(serialize_canonical(tj), bytes);
+    EXPECT_EQ(canonical_hash(tj), canonical_hash(ti));
+
+    RawXxHash64 checksum;
+
+    checksum.update(bytes.data(), bytes.size());
+    EXPECT_EQ(canonical_hash(ti), checksum.value());
+
+    RawMemoryReader reader(bytes.data(), bytes.size());
+    Type to;
+
+    deserialize(make_stream_buffer(reader), to);
+    EXPECT_TRUE(reader.good());
+    EXPECT_EQ(to, ti);
+
+    // the plain stream serialization is kept
+    std::vector<char> buf(serialized_size(ti));
+    RawBoundedWriter writer(buf.data(), buf.size());
+
+    serialize(make_stream_buffer(writer), ti);
+    EXPECT_EQ(buf, flat(ti));
+}
+
+TEST(RawStreamCanonical, Parallel)
+{
+    const size_t n = 100000;
+    using Type = std::unordered_map<std::string, int>;
+
+    Type ti;
+    Type tj;
+
+    tj.reserve(n * 4);
+    for (size_t idx = 0; idx < n; ++idx)
+    {
+        ti.emplace(std::to_string(idx * 7919), int(idx));
+        tj.emplace(std::to_string((n - 1 - idx) * 7919), int(n - 1 - idx));
+    }
+
+    auto t0 = std::chrono::system_clock::now();
+    const auto bytes = serialize_canonical(ti, 1);
+    auto t1 = std::chrono::system_clock::now();
+    const auto bytes_parallel = serialize_canonical(tj, 4);
+    auto t2 = std::chrono::system_clock::now();
+
+    LOG() << "+" << std::chrono::duration<double, std::micro>(t1 - t0).count()
+          << "us with 1 thread, "
+          << "+" << std::chrono::duration<double, std::micro>(t2 - t1).count()
+          << "us with 4 threads, for " << n << " items" << std::endl;
+
+    EXPECT_EQ(bytes_parallel, bytes);
+
+    Type to;
+
+    deserialize(bytes.data(), to);
+    EXPECT_EQ(to, ti);
+}
+
+} // namespace NAMESPACE
+
+int main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
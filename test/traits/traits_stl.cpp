@@ -17,6 +17,7 @@ Copyleft 2018 Macrobull
 #include <stack>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <valarray>
 #include <vector>
@@ -293,6 +294,33 @@ TEST(TraitsStlContainer, BatchInsertable)
     }
 }
 
+TEST(TraitsStlContainer, UnorderedType)
+{
+    {
+        auto void_result = is_unordered_container_type<void_type>::value;
+        auto trivial_tresult = is_unordered_container_type<trivial_type>::value;
+        auto functor_result = is_unordered_container_type<std::hash<int>>::value;
+        auto vector_result = is_unordered_container_type<vector_type>::value;
+        auto string_result = is_unordered_container_type<string_type>::value;
+        auto map_result = is_unordered_container_type<map_type>::value;
+        auto ummap_result = is_unordered_container_type<ummap_type>::value;
+        auto set_result = is_unordered_container_type<set_type>::value;
+        auto uset_result = is_unordered_container_type<std::unordered_set<float>>::value;
+        auto queue_result = is_unordered_container_type<queue_type>::value;
+
+        EXPECT_EQ(void_result, false);
+        EXPECT_EQ(trivial_tresult, false);
+        EXPECT_EQ(functor_result, false);
+        EXPECT_EQ(vector_result, false);
+        EXPECT_EQ(string_result, false);
+        EXPECT_EQ(map_result, false);
+        EXPECT_EQ(ummap_result, true);
+        EXPECT_EQ(set_result, false);
+        EXPECT_EQ(uset_result, true);
+        EXPECT_EQ(queue_result, false);
+    }
+}
+
 TEST(TraitsStlContainer, SerializationCopyable)
 {
     using Type = std::vector<int>;